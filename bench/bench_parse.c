@@ -0,0 +1,501 @@
+/*---------------------------------------------------------------------
+ * Parser benchmark
+ *
+ * Runs the c-lisp program grammar over generated corpora and reports
+ * throughput, allocations per byte and peak resident memory as JSON.
+ * mpc.c and parsing.c are built into this file so that every
+ * allocation they make can be counted.
+ *
+ *   bench_parse [megabytes per corpus]
+ *---------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------
+ * HEADERS
+ *---------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 200809L
+#define CLISP_NO_MAIN
+
+/* Only the parser is measured, the interpreter needs no native code */
+#define CLISP_NO_JIT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Allocations are counted by routing the library's calls through these
+ * before its sources are included below */
+static unsigned long bench_allocs = 0;
+
+static void* bench_malloc(size_t n)
+{
+bench_allocs++;
+return malloc(n);
+}
+
+static void* bench_calloc(size_t n, size_t m)
+{
+bench_allocs++;
+return calloc(n, m);
+}
+
+static void* bench_realloc(void* p, size_t n)
+{
+bench_allocs++;
+return realloc(p, n);
+}
+
+#define malloc(n)     bench_malloc(n)
+#define calloc(n, m)  bench_calloc(n, m)
+#define realloc(p, n) bench_realloc(p, n)
+
+#include "../mpc.c"
+#include "../parsing.c"
+
+/*---------------------------------------------------------------------
+ * TYPE DECLARATIONS
+ *---------------------------------------------------------------------*/
+/* A growing buffer that corpora are written into */
+typedef struct
+    {
+    char* text;
+    size_t length;
+    size_t capacity;
+    } corpus;
+
+typedef void (*corpus_generator)
+    (
+    corpus* c,
+    size_t size
+    );
+
+typedef struct
+    {
+    const char* name;
+    corpus_generator generate;
+    size_t scale;
+    } corpus_spec;
+
+typedef int bench_mode; enum
+    {
+    BENCH_TREE,
+    BENCH_RECOVER,
+    BENCH_MODES
+    };
+
+/* Each measurement is repeated until it has run for this long */
+#define BENCH_MIN_SECONDS 0.2
+enum { BENCH_MAX_RUNS = 50 };
+
+/*---------------------------------------------------------------------
+ * FUNCTION DECLARATIONS
+ *---------------------------------------------------------------------*/
+/* Corpora */
+void corpus_add
+    (
+    corpus* c,
+    const char* text
+    );
+
+void corpus_deep
+    (
+    corpus* c,
+    size_t size
+    );
+
+void corpus_wide
+    (
+    corpus* c,
+    size_t size
+    );
+
+void corpus_numbers
+    (
+    corpus* c,
+    size_t size
+    );
+
+void corpus_symbols
+    (
+    corpus* c,
+    size_t size
+    );
+
+void corpus_malformed
+    (
+    corpus* c,
+    size_t size
+    );
+
+void corpus_large
+    (
+    corpus* c,
+    size_t size
+    );
+
+/* Measuring */
+size_t bench_parse
+    (
+    language* lang,
+    bench_mode mode,
+    const corpus* c,
+    int* ok
+    );
+
+void bench_run
+    (
+    const corpus_spec* spec,
+    bench_mode mode,
+    size_t megabytes,
+    int first
+    );
+
+long bench_peak_rss
+    (
+    void
+    );
+
+/*---------------------------------------------------------------------
+ * VARIABLES
+ *---------------------------------------------------------------------*/
+static const corpus_spec corpora[] =
+    {
+    { "deep",      corpus_deep,      1 },
+    { "wide",      corpus_wide,      1 },
+    { "numbers",   corpus_numbers,   1 },
+    { "symbols",   corpus_symbols,   1 },
+    { "malformed", corpus_malformed, 1 },
+    { "large",     corpus_large,     8 }
+    };
+
+static const char* mode_names[BENCH_MODES] = { "tree", "recover" };
+
+/* Small deterministic generator so corpora are the same on each run */
+static unsigned long bench_seed = 1;
+
+static unsigned long bench_random
+    (
+    void
+    )
+{
+bench_seed = bench_seed * 1103515245UL + 12345UL;
+return ( bench_seed >> 16 ) & 0x7FFF;
+}
+
+/*---------------------------------------------------------------------
+ * FUNCTIONS
+ *---------------------------------------------------------------------*/
+int main
+    (
+    int argc,
+    char** argv
+    )
+{
+size_t megabytes = 1;
+int first = 1;
+
+if( argc > 1 )
+    {
+    megabytes = (size_t)strtoul(argv[1], NULL, 10);
+    if( megabytes == 0 ) { megabytes = 1; }
+    }
+
+printf("{\n  \"megabytes\": %lu,\n  \"results\": [\n", (unsigned long)megabytes);
+fflush(stdout);
+
+/* Every measurement runs in its own process so that its peak memory
+ * is its own */
+for( size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i )
+    {
+    for( int mode = 0; mode < BENCH_MODES; ++mode )
+        {
+        pid_t pid = fork();
+        if( pid == 0 )
+            {
+            bench_run(&corpora[i], mode, megabytes, first);
+            fflush(stdout);
+            _exit(0);
+            }
+        waitpid(pid, NULL, 0);
+        first = 0;
+        }
+    }
+
+printf("\n  ]\n}\n");
+return 0;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_add
+    (
+    corpus* c,
+    const char* text
+    )
+{
+size_t length = strlen(text);
+
+if( c->length + length + 1 > c->capacity )
+    {
+    while( c->length + length + 1 > c->capacity )
+        {
+        c->capacity = c->capacity ? c->capacity * 2 : 4096;
+        }
+    c->text = realloc(c->text, c->capacity);
+    }
+
+memcpy(c->text + c->length, text, length + 1);
+c->length += length;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_deep
+    (
+    corpus* c,
+    size_t size
+    )
+{
+/* Forms nested a few hundred lists deep */
+while( c->length < size )
+    {
+    for( int i = 0; i < 400; ++i ) { corpus_add(c, "(+ 1 "); }
+    corpus_add(c, "2");
+    for( int i = 0; i < 400; ++i ) { corpus_add(c, ")"); }
+    corpus_add(c, "\n");
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_wide
+    (
+    corpus* c,
+    size_t size
+    )
+{
+char number[32];
+
+/* Single lists of tens of thousands of elements */
+while( c->length < size )
+    {
+    corpus_add(c, "(+");
+    for( int i = 0; i < 50000 && c->length < size; ++i )
+        {
+        sprintf(number, " %lu", bench_random() % 1000);
+        corpus_add(c, number);
+        }
+    corpus_add(c, ")\n");
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_numbers
+    (
+    corpus* c,
+    size_t size
+    )
+{
+char number[32];
+
+/* Lists of long literals, some negative and some out of range */
+while( c->length < size )
+    {
+    corpus_add(c, "(*");
+    for( int i = 0; i < 16; ++i )
+        {
+        sprintf(number, " %s%04lu%04lu%04lu%04lu%s",
+            bench_random() % 4 == 0 ? "-" : "",
+            bench_random() % 10000, bench_random() % 10000,
+            bench_random() % 10000, bench_random() % 10000,
+            bench_random() % 64 == 0 ? "123456" : "");
+        corpus_add(c, number);
+        }
+    corpus_add(c, ")\n");
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_symbols
+    (
+    corpus* c,
+    size_t size
+    )
+{
+static const char* symbols[] = { " +", " -", " *", " /", " %" };
+
+/* Lists made of operators alone */
+while( c->length < size )
+    {
+    corpus_add(c, "(+");
+    for( int i = 0; i < 40; ++i )
+        {
+        corpus_add(c, symbols[bench_random() % 5]);
+        }
+    corpus_add(c, ")\n");
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_malformed
+    (
+    corpus* c,
+    size_t size
+    )
+{
+static const char* broken[] = { "(+ 1 ] 2)\n", "(* 3 x)\n", ")\n", "(- 4 (5\n" };
+int line = 0;
+
+/* Ordinary forms with a broken one every so often. Whole parses stop
+ * at the first, recovering parses read past all of them. */
+while( c->length < size )
+    {
+    if( ++line % 64 == 0 )
+        {
+        corpus_add(c, broken[bench_random() % 4]);
+        }
+    else
+        {
+        corpus_add(c, "(+ 1 (* 2 3) (- 4 5))\n");
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void corpus_large
+    (
+    corpus* c,
+    size_t size
+    )
+{
+char form[128];
+
+/* A large file of small, varied forms */
+while( c->length < size )
+    {
+    sprintf(form, "(+ %lu (* %lu (- %lu 7)) (/ %lu 3) %lu)\n",
+        bench_random(), bench_random() % 100, bench_random(),
+        bench_random() + 1, bench_random() % 10);
+    corpus_add(c, form);
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+size_t bench_parse
+    (
+    language* lang,
+    bench_mode mode,
+    const corpus* c,
+    int* ok
+    )
+{
+mpc_result_t r;
+mpc_recovery_t recovery;
+size_t parsed = c->length;
+
+switch( mode )
+    {
+    case BENCH_TREE:
+        *ok = mpc_nparse("bench", c->text, c->length, lang->program, &r);
+        break;
+
+    default:
+        *ok = mpc_nparse_recover("bench", c->text, c->length, lang->expression,
+            "(", ")", &recovery);
+        mpc_recovery_clear(&recovery, (mpc_dtor_t)mpc_ast_delete);
+        return parsed;
+    }
+
+/* A failed parse only read up to its error */
+if( *ok )
+    {
+    mpc_ast_delete(r.output);
+    }
+else
+    {
+    parsed = (size_t)r.error->state.pos;
+    mpc_err_delete(r.error);
+    }
+
+return parsed;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void bench_run
+    (
+    const corpus_spec* spec,
+    bench_mode mode,
+    size_t megabytes,
+    int first
+    )
+{
+corpus c = { NULL, 0, 0 };
+language lang;
+unsigned long allocs = 0;
+size_t parsed;
+double seconds = 0.0;
+int runs = 0;
+int ok;
+
+spec->generate(&c, spec->scale * megabytes * 1024 * 1024);
+
+language_init(&lang);
+
+/* The first run also counts allocations */
+bench_allocs = 0;
+do
+    {
+    clock_t start = clock();
+    parsed = bench_parse(&lang, mode, &c, &ok);
+    seconds += (double)( clock() - start ) / CLOCKS_PER_SEC;
+    if( runs++ == 0 ) { allocs = bench_allocs; }
+    }
+while( seconds < BENCH_MIN_SECONDS && runs < BENCH_MAX_RUNS );
+
+seconds /= runs;
+
+printf("%s    { \"corpus\": \"%s\", \"mode\": \"%s\", \"bytes\": %lu, "
+    "\"parsed\": %lu, \"ok\": %s, \"runs\": %d, \"seconds\": %.6f, "
+    "\"mb_per_s\": %.3f, \"allocs\": %lu, \"allocs_per_byte\": %.4f, "
+    "\"peak_rss_kb\": %ld }",
+    first ? "" : ",\n",
+    spec->name, mode_names[mode], (unsigned long)c.length,
+    (unsigned long)parsed, ok ? "true" : "false", runs, seconds,
+    seconds > 0.0 ? ( parsed / ( 1024.0 * 1024.0 ) ) / seconds : 0.0,
+    allocs, parsed ? (double)allocs / parsed : 0.0,
+    bench_peak_rss());
+
+language_free(&lang);
+free(c.text);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+long bench_peak_rss
+    (
+    void
+    )
+{
+struct rusage usage;
+
+getrusage(RUSAGE_SELF, &usage);
+
+/* Linux reports kilobytes, Mac OS reports bytes */
+#ifdef __APPLE__
+return usage.ru_maxrss / 1024;
+#else
+return usage.ru_maxrss;
+#endif
+}
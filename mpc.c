@@ -1,5 +1,9 @@
 #include "mpc.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
 ** State Type
 */
@@ -20,6 +24,184 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+/*
+** UTF-8
+**
+** Input is taken as UTF-8 where it is valid and
+** as single bytes where it is not. Runs of ASCII
+** are skipped over a word or vector at a time so
+** that plain ASCII input pays almost nothing.
+*/
+
+static const unsigned long long mpc_utf8_high = 0x8080808080808080ULL;
+
+static unsigned long long mpc_utf8_word(const char *s) {
+  unsigned long long w;
+  memcpy(&w, s, sizeof(w));
+  return w;
+}
+
+/* Number of codepoints, counting every byte which is not a continuation byte */
+static long mpc_utf8_count(const char *s, long n) {
+  
+  long k = 0, c = 0;
+  unsigned long long w;
+  
+  for (; k + 8 <= n; k += 8) {
+    w = mpc_utf8_word(s + k);
+    if ((w & mpc_utf8_high) == 0) { c += 8; continue; }
+    w = (w & ~(w << 1)) & mpc_utf8_high;
+    c += 8 - (long)(((w >> 7) * 0x0101010101010101ULL) >> 56);
+  }
+  
+  for (; k < n; k++) {
+    c += ((unsigned char)s[k] & 0xC0) != 0x80;
+  }
+  
+  return c;
+}
+
+/* Length of the valid sequence starting at `s` or zero if it is invalid */
+static int mpc_utf8_length(const unsigned char *s, long n) {
+  
+  unsigned char lo = 0x80, hi = 0xBF;
+  int k, len;
+  
+  if (s[0] < 0x80) { return 1; }
+  if (s[0] < 0xC2) { return 0; }
+  if (s[0] < 0xE0) { len = 2; }
+  else if (s[0] < 0xF0) {
+    len = 3;
+    if (s[0] == 0xE0) { lo = 0xA0; }
+    if (s[0] == 0xED) { hi = 0x9F; }
+  } else if (s[0] < 0xF5) {
+    len = 4;
+    if (s[0] == 0xF0) { lo = 0x90; }
+    if (s[0] == 0xF4) { hi = 0x8F; }
+  } else { return 0; }
+  
+  if (n < len) { return 0; }
+  if (s[1] < lo || s[1] > hi) { return 0; }
+  for (k = 2; k < len; k++) {
+    if ((s[k] & 0xC0) != 0x80) { return 0; }
+  }
+  
+  return len;
+}
+
+static int mpc_utf8_decode(const char *s, long n, unsigned long *c) {
+  
+  const unsigned char *u = (const unsigned char*)s;
+  int k, len = mpc_utf8_length(u, n);
+  
+  switch (len) {
+    case 1: *c = u[0]; break;
+    case 2: *c = u[0] & 0x1F; break;
+    case 3: *c = u[0] & 0x0F; break;
+    case 4: *c = u[0] & 0x07; break;
+    default: *c = u[0]; return 0;
+  }
+  
+  for (k = 1; k < len; k++) { *c = (*c << 6) | (u[k] & 0x3F); }
+  return len;
+}
+
+long mpc_utf8_check(const char *s, long n) {
+  
+  const unsigned char *u = (const unsigned char*)s;
+  long k = 0;
+  int len;
+  
+  while (k < n) {
+    
+#if defined(__SSE2__)
+    while (k + 16 <= n
+    && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(u + k))) == 0) {
+      k += 16;
+    }
+#endif
+    while (k + 8 <= n && (mpc_utf8_word(s + k) & mpc_utf8_high) == 0) {
+      k += 8;
+    }
+    
+    if (k == n) { break; }
+    if (u[k] < 0x80) { k++; continue; }
+    
+    len = mpc_utf8_length(u + k, n - k);
+    if (len == 0) { return k; }
+    k += len;
+  }
+  
+  return -1;
+}
+
+/*
+** Number Scanning
+**
+** Integer literals are read straight from the
+** text. Eight digits at a time are checked and
+** combined within a single word, and the value
+** is accumulated with checked multiply-adds so
+** that overflow is found without `errno`.
+*/
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MPC_SCAN_SWAR
+#endif
+
+#ifdef MPC_SCAN_SWAR
+
+static int mpc_scan_eight(const char *s) {
+  unsigned long long w = mpc_utf8_word(s);
+  return ((w & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL)
+      && (((w + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL);
+}
+
+static unsigned long mpc_scan_eight_value(const char *s) {
+  unsigned long long w = mpc_utf8_word(s) - 0x3030303030303030ULL;
+  w = (w * 10) + (w >> 8);
+  w = (((w & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+    +  (((w >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+  return (unsigned long)w;
+}
+
+#endif
+
+long mpc_scan_long(const char *s, long n, long *x, int *overflow) {
+  
+  unsigned long acc = 0, limit = LONG_MAX, d;
+  long k = 0, start;
+  
+  *overflow = 0;
+  
+  if (k < n && s[k] == '-') { limit = (unsigned long)LONG_MAX + 1; k++; }
+  start = k;
+  
+#ifdef MPC_SCAN_SWAR
+  while (k + 8 <= n && mpc_scan_eight(s + k)) {
+    d = mpc_scan_eight_value(s + k);
+    if (acc > (limit - d) / 100000000UL) { *overflow = 1; }
+    acc = acc * 100000000UL + d;
+    k += 8;
+  }
+#endif
+  
+  while (k < n && s[k] >= '0' && s[k] <= '9') {
+    d = (unsigned long)(s[k] - '0');
+    if (acc > (limit - d) / 10) { *overflow = 1; }
+    acc = acc * 10 + d;
+    k++;
+  }
+  
+  if (k == start) { *x = 0; return 0; }
+  
+  if (*overflow) { *x = limit == (unsigned long)LONG_MAX ? LONG_MAX : LONG_MIN; }
+  else if (limit == (unsigned long)LONG_MAX) { *x = (long)acc; }
+  else { *x = acc == limit ? LONG_MIN : -(long)acc; }
+  
+  return k;
+}
+
 /*
 ** Input Type
 */
@@ -73,6 +255,11 @@ typedef struct {
   char mem[64];
 } mpc_mem_t;
 
+typedef struct {
+  mpc_state_t state;
+  char last;
+} mpc_mark_t;
+
 typedef struct {
 
   int type;
@@ -80,6 +267,7 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  long length;
   char *buffer;
   FILE *file;
   
@@ -87,9 +275,15 @@ typedef struct {
   int backtrack;
   int marks_slots;
   int marks_num;
-  mpc_state_t *marks;
+  int marks_peak;
+  mpc_mark_t *marks;
+  unsigned long rewinds;
+  
+  unsigned long steps;
+  unsigned long steps_limit;
+  mpc_state_t steps_state;
+  mpc_dtor_t steps_dtor;
   
-  char *lasts;
   char last;
   
   size_t mem_index;
@@ -108,17 +302,22 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
+  memcpy(i->string, string, i->length + 1);
   i->buffer = NULL;
   i->file = NULL;
   
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->steps_limit = 0;
+  i->steps_dtor = NULL;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
   i->mem_index = 0;
@@ -140,15 +339,20 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = strlen(i->string);
   i->buffer = NULL;
   i->file = NULL;
   
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->steps_limit = 0;
+  i->steps_dtor = NULL;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
   i->mem_index = 0;
@@ -169,15 +373,20 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->steps_limit = 0;
+  i->steps_dtor = NULL;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
   i->mem_index = 0;
@@ -197,15 +406,20 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->steps_limit = 0;
+  i->steps_dtor = NULL;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
   i->mem_index = 0;
@@ -222,7 +436,6 @@ static void mpc_input_delete(mpc_input_t *i) {
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
   free(i->marks);
-  free(i->lasts);
   free(i);
 }
 
@@ -296,20 +509,30 @@ static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 static void mpc_input_suppress_disable(mpc_input_t *i) { i->suppress--; }
 static void mpc_input_suppress_enable(mpc_input_t *i) { i->suppress++; }
 
+/*
+** The mark stack only ever grows while parsing.
+** Marking and unmarking happen around almost
+** every `and`, `not` and `string` so shrinking
+** it on unmark would realloc whenever a parse
+** oscillates around some nesting depth. It can
+** be returned to its minimum size between
+** parses with `mpc_input_marks_trim`.
+*/
+
 static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
-  i->marks_num++;
-  
-  if (i->marks_num > i->marks_slots) {
-    i->marks_slots = i->marks_num + i->marks_num / 2;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+  if (i->marks_num == i->marks_slots) {
+    i->marks_slots = i->marks_slots * 2;
+    i->marks = realloc(i->marks, sizeof(mpc_mark_t) * i->marks_slots);
   }
 
-  i->marks[i->marks_num-1] = i->state;
-  i->lasts[i->marks_num-1] = i->last;
+  i->marks[i->marks_num].state = i->state;
+  i->marks[i->marks_num].last = i->last;
+  i->marks_num++;
+  
+  if (i->marks_num > i->marks_peak) { i->marks_peak = i->marks_num; }
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
     i->buffer = calloc(1, 1);
@@ -323,15 +546,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
   
   i->marks_num--;
   
-  if (i->marks_slots > i->marks_num + i->marks_num / 2
-  &&  i->marks_slots > MPC_INPUT_MARKS_MIN) {
-    i->marks_slots = 
-      i->marks_num > MPC_INPUT_MARKS_MIN ?
-      i->marks_num : MPC_INPUT_MARKS_MIN;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
-  }
-  
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
     free(i->buffer);
     i->buffer = NULL;
@@ -343,8 +557,9 @@ static void mpc_input_rewind(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
-  i->state = i->marks[i->marks_num-1];
-  i->last  = i->lasts[i->marks_num-1];
+  i->rewinds++;
+  i->state = i->marks[i->marks_num-1].state;
+  i->last  = i->marks[i->marks_num-1].last;
   
   if (i->type == MPC_INPUT_FILE) {
     fseek(i->file, i->state.pos, SEEK_SET);
@@ -353,16 +568,22 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
+static void mpc_input_marks_trim(mpc_input_t *i) {
+  if (i->marks_num > 0 || i->marks_slots == MPC_INPUT_MARKS_MIN) { return; }
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = realloc(i->marks, sizeof(mpc_mark_t) * i->marks_slots);
+}
+
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].state.pos);
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return i->buffer[i->state.pos - i->marks[0].state.pos];
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -374,7 +595,7 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
@@ -397,7 +618,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -460,7 +681,9 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   i->last = c;
   i->state.pos++;
-  i->state.col++;
+  
+  /* Columns count codepoints rather than bytes */
+  if (((unsigned char)c & 0xC0) != 0x80) { i->state.col++; }
   
   if (c == '\n') {
     i->state.col = 0;
@@ -512,9 +735,41 @@ static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
   return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
+/* Move over `n` bytes of string input at once */
+static void mpc_input_advance(mpc_input_t *i, long n) {
+  
+  const char *s = i->string + i->state.pos;
+  const char *line = s;
+  const char *nl;
+  
+  while ((nl = memchr(line, '\n', (s + n) - line))) {
+    i->state.row++;
+    line = nl + 1;
+  }
+  
+  if (line != s) { i->state.col = 0; }
+  i->state.col += mpc_utf8_count(line, (s + n) - line);
+  i->state.pos += n;
+  i->last = s[n-1];
+}
+
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
   const char *x = c;
+  long n;
+  
+  /* String input can be compared in bulk. Without backtracking the
+  ** matched prefix of a failed string stays consumed, so leave that
+  ** case to the loop below. */
+  if (i->type == MPC_INPUT_STRING && i->backtrack > 0) {
+    n = (long)strlen(c);
+    if (n > i->length - i->state.pos
+    || memcmp(i->string + i->state.pos, c, n) != 0) { return 0; }
+    if (n > 0) { mpc_input_advance(i, n); }
+    *o = mpc_malloc(i, n + 1);
+    memcpy(*o, c, n + 1);
+    return 1;
+  }
 
   mpc_input_mark(i);
   while (*x) {
@@ -531,6 +786,99 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   return 1;
 }
 
+static int mpc_input_int_lit(mpc_input_t *i, char **o) {
+  
+  long n, x;
+  int overflow;
+  char c;
+  
+  /* String input is scanned in place in one step */
+  if (i->type == MPC_INPUT_STRING && i->backtrack > 0) {
+    n = mpc_scan_long(i->string + i->state.pos, i->length - i->state.pos, &x, &overflow);
+    if (n == 0) { return 0; }
+    *o = mpc_malloc(i, n + 1);
+    memcpy(*o, i->string + i->state.pos, n);
+    (*o)[n] = '\0';
+    mpc_input_advance(i, n);
+    return 1;
+  }
+  
+  mpc_input_mark(i);
+  
+  n = 0;
+  *o = mpc_malloc(i, 2);
+  if (mpc_input_char(i, '-', NULL)) { (*o)[n++] = '-'; }
+  
+  while (1) {
+    c = mpc_input_peekc(i);
+    if (c < '0' || c > '9' || !mpc_input_range(i, '0', '9', NULL)) { break; }
+    *o = mpc_realloc(i, *o, n + 2);
+    (*o)[n++] = c;
+  }
+  
+  if (n == 0 || (*o)[n-1] == '-') {
+    mpc_free(i, *o);
+    mpc_input_rewind(i);
+    return 0;
+  }
+  
+  (*o)[n] = '\0';
+  mpc_input_unmark(i);
+  return 1;
+}
+
+/*
+** A codepoint which is either one of the single
+** bytes in `c` or within one of `n` ranges stored
+** as pairs in `xs`. Multibyte string input
+** is decoded in place, other input is read a byte
+** at a time.
+*/
+
+static int mpc_input_codepoint(mpc_input_t *i, const char *c, int n, const unsigned long *xs, char **o) {
+  
+  char s[4];
+  unsigned long x;
+  int j, len;
+  
+  s[0] = mpc_input_peekc(i);
+  if ((unsigned char)s[0] < 0xC2 || strchr(c, s[0])) { return mpc_input_oneof(i, c, o); }
+  
+  if (i->type == MPC_INPUT_STRING && i->backtrack > 0) {
+    len = mpc_utf8_decode(i->string + i->state.pos, i->length - i->state.pos, &x);
+    if (len < 2) { return 0; }
+    for (j = 0; j < n; j++) {
+      if (x >= xs[2*j] && x <= xs[2*j+1]) { break; }
+    }
+    if (j == n) { return 0; }
+    *o = mpc_malloc(i, len + 1);
+    memcpy(*o, i->string + i->state.pos, len);
+    (*o)[len] = '\0';
+    mpc_input_advance(i, len);
+    return 1;
+  }
+  
+  len = (unsigned char)s[0] < 0xE0 ? 2 : (unsigned char)s[0] < 0xF0 ? 3 : 4;
+  
+  mpc_input_mark(i);
+  for (j = 0; j < len; j++) {
+    s[j] = mpc_input_peekc(i);
+    if (!mpc_input_any(i, NULL)) { mpc_input_rewind(i); return 0; }
+  }
+  
+  if (mpc_utf8_decode(s, len, &x) != len) { mpc_input_rewind(i); return 0; }
+  for (j = 0; j < n; j++) {
+    if (x >= xs[2*j] && x <= xs[2*j+1]) { break; }
+  }
+  if (j == n) { mpc_input_rewind(i); return 0; }
+  
+  mpc_input_unmark(i);
+  *o = mpc_malloc(i, len + 1);
+  memcpy(*o, s, len);
+  (*o)[len] = '\0';
+  return 1;
+}
+
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
   *o = NULL;
   return f(i->last, mpc_input_peekc(i));
@@ -542,6 +890,81 @@ static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   return r;
 }
 
+/*
+** Output Buffer
+**
+** The buffer always keeps room for and writes
+** a terminating null so that its contents can
+** be handed out directly as a string.
+*/
+
+void mpc_buf_init(mpc_buf_t *b) {
+  b->capacity = 256;
+  b->length = 0;
+  b->data = malloc(b->capacity);
+  b->data[0] = '\0';
+}
+
+void mpc_buf_free(mpc_buf_t *b) {
+  free(b->data);
+  b->data = NULL;
+  b->length = 0;
+  b->capacity = 0;
+}
+
+void mpc_buf_clear(mpc_buf_t *b) {
+  b->length = 0;
+  b->data[0] = '\0';
+}
+
+size_t mpc_buf_write(mpc_buf_t *b, FILE *f) {
+  size_t n = fwrite(b->data, 1, b->length, f);
+  mpc_buf_clear(b);
+  return n;
+}
+
+static char *mpc_buf_reserve(mpc_buf_t *b, size_t n) {
+  if (b->length + n + 1 > b->capacity) {
+    while (b->length + n + 1 > b->capacity) { b->capacity *= 2; }
+    b->data = realloc(b->data, b->capacity);
+  }
+  return b->data + b->length;
+}
+
+static void mpc_buf_putn(mpc_buf_t *b, const char *s, size_t n) {
+  memcpy(mpc_buf_reserve(b, n), s, n);
+  b->length += n;
+  b->data[b->length] = '\0';
+}
+
+static void mpc_buf_puts(mpc_buf_t *b, const char *s) {
+  mpc_buf_putn(b, s, strlen(s));
+}
+
+static void mpc_buf_putc(mpc_buf_t *b, char c) {
+  mpc_buf_reserve(b, 1)[0] = c;
+  b->length++;
+  b->data[b->length] = '\0';
+}
+
+static void mpc_buf_fill(mpc_buf_t *b, char c, size_t n) {
+  memset(mpc_buf_reserve(b, n), c, n);
+  b->length += n;
+  b->data[b->length] = '\0';
+}
+
+static void mpc_buf_putl(mpc_buf_t *b, long x) {
+  
+  char digits[24];
+  int n = sizeof(digits);
+  unsigned long u = x < 0 ? 0ul - (unsigned long)x : (unsigned long)x;
+  
+  do { digits[--n] = (char)('0' + u % 10); u /= 10; } while (u);
+  if (x < 0) { digits[--n] = '-'; }
+  
+  mpc_buf_putn(b, digits + n, sizeof(digits) - n);
+}
+
 /*
 ** Error Type
 */
@@ -560,81 +983,83 @@ void mpc_err_print(mpc_err_t *x) {
 }
 
 void mpc_err_print_to(mpc_err_t *x, FILE *f) {
-  char *str = mpc_err_string(x);
-  fprintf(f, "%s", str);
-  free(str);
-}
-
-static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt, ...) {
-  /* TODO: Error Checking on Length */
-  int left = ((*max) - (*pos));
-  va_list va;
-  va_start(va, fmt);
-  if (left < 0) { left = 0;}
-  (*pos) += vsprintf(buffer + (*pos), fmt, va);
-  va_end(va);
+  mpc_buf_t b;
+  mpc_buf_init(&b);
+  mpc_err_print_buf(x, &b);
+  mpc_buf_write(&b, f);
+  mpc_buf_free(&b);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
-  
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+static void mpc_err_print_recieved(mpc_buf_t *b, char c) {
   
   switch (c) {
-    case '\a': return "bell";
-    case '\b': return "backspace";
-    case '\f': return "formfeed";
-    case '\r': return "carriage return";
-    case '\v': return "vertical tab";
-    case '\0': return "end of input";
-    case '\n': return "newline";
-    case '\t': return "tab";
-    case ' ' : return "space";
+    case '\a': mpc_buf_puts(b, "bell"); return;
+    case '\b': mpc_buf_puts(b, "backspace"); return;
+    case '\f': mpc_buf_puts(b, "formfeed"); return;
+    case '\r': mpc_buf_puts(b, "carriage return"); return;
+    case '\v': mpc_buf_puts(b, "vertical tab"); return;
+    case '\0': mpc_buf_puts(b, "end of input"); return;
+    case '\n': mpc_buf_puts(b, "newline"); return;
+    case '\t': mpc_buf_puts(b, "tab"); return;
+    case ' ' : mpc_buf_puts(b, "space"); return;
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      if ((unsigned char)c >= 0x80) {
+        mpc_buf_puts(b, "byte 0x");
+        mpc_buf_putc(b, "0123456789ABCDEF"[(unsigned char)c >> 4]);
+        mpc_buf_putc(b, "0123456789ABCDEF"[(unsigned char)c & 15]);
+        return;
+      }
+      mpc_buf_putc(b, '\'');
+      mpc_buf_putc(b, c);
+      mpc_buf_putc(b, '\'');
+      return;
   }
   
 }
 
-char *mpc_err_string(mpc_err_t *x) {
+void mpc_err_print_buf(mpc_err_t *x, mpc_buf_t *b) {
 
-  int i;  
-  int pos = 0; 
-  int max = 1023;
-  char *buffer = calloc(1, 1024);
+  int i;
+  
+  mpc_buf_puts(b, x->filename);
   
   if (x->failure) {
-    mpc_err_string_cat(buffer, &pos, &max,
-    "%s: error: %s\n", x->filename, x->failure);
-    return buffer;
+    mpc_buf_puts(b, ": error: ");
+    mpc_buf_puts(b, x->failure);
+    mpc_buf_putc(b, '\n');
+    return;
   }
   
-  mpc_err_string_cat(buffer, &pos, &max, 
-    "%s:%i:%i: error: expected ", x->filename, x->state.row+1, x->state.col+1);
+  mpc_buf_putc(b, ':');
+  mpc_buf_putl(b, x->state.row+1);
+  mpc_buf_putc(b, ':');
+  mpc_buf_putl(b, x->state.col+1);
+  mpc_buf_puts(b, ": error: expected ");
   
-  if (x->expected_num == 0) { mpc_err_string_cat(buffer, &pos, &max, "ERROR: NOTHING EXPECTED"); }
-  if (x->expected_num == 1) { mpc_err_string_cat(buffer, &pos, &max, "%s", x->expected[0]); }
+  if (x->expected_num == 0) { mpc_buf_puts(b, "ERROR: NOTHING EXPECTED"); }
+  if (x->expected_num == 1) { mpc_buf_puts(b, x->expected[0]); }
   if (x->expected_num >= 2) {
   
     for (i = 0; i < x->expected_num-2; i++) {
-      mpc_err_string_cat(buffer, &pos, &max, "%s, ", x->expected[i]);
+      mpc_buf_puts(b, x->expected[i]);
+      mpc_buf_puts(b, ", ");
     } 
     
-    mpc_err_string_cat(buffer, &pos, &max, "%s or %s", 
-      x->expected[x->expected_num-2], 
-      x->expected[x->expected_num-1]);
+    mpc_buf_puts(b, x->expected[x->expected_num-2]);
+    mpc_buf_puts(b, " or ");
+    mpc_buf_puts(b, x->expected[x->expected_num-1]);
   }
   
-  mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
-  mpc_err_string_cat(buffer, &pos, &max, "\n");
-  
-  return realloc(buffer, strlen(buffer) + 1);
+  mpc_buf_puts(b, " at ");
+  mpc_err_print_recieved(b, x->recieved);
+  mpc_buf_putc(b, '\n');
+}
+
+char *mpc_err_string(mpc_err_t *x) {
+  mpc_buf_t b;
+  mpc_buf_init(&b);
+  mpc_err_print_buf(x, &b);
+  return realloc(b.data, b.length + 1);
 }
 
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
@@ -882,7 +1307,10 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_INT_LIT   = 25,
+  MPC_TYPE_CODEPOINT = 26
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -900,6 +1328,7 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { char *x; int n; unsigned long *xs; } mpc_pdata_codepoint_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -917,13 +1346,34 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_codepoint_t codepoint;
 } mpc_pdata_t;
 
+/*
+** Profiling counters of a named parser. Calls,
+** successes and failures count every invocation.
+** Bytes, rewinds and time are only added up by
+** the outermost invocation of a recursive rule
+** so nested invocations are not counted twice.
+*/
+
+typedef struct {
+  unsigned long invocations;
+  unsigned long successes;
+  unsigned long failures;
+  unsigned long rewinds;
+  unsigned long bytes;
+  clock_t time;
+  int active;
+} mpc_profile_t;
+
 struct mpc_parser_t {
   char *name;
   mpc_pdata_t data;
   char type;
   char retained;
+  int marks_peak;
+  mpc_profile_t *profile;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -1006,7 +1456,75 @@ enum {
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
+typedef struct {
+  long pos;
+  unsigned long rewinds;
+  clock_t start;
+} mpc_profile_frame_t;
+
+static void mpc_profile_enter(mpc_input_t *i, mpc_profile_t *f, mpc_profile_frame_t *s) {
+  s->pos = i->state.pos;
+  s->rewinds = i->rewinds;
+  s->start = f->active == 0 ? clock() : 0;
+  f->invocations++;
+  f->active++;
+}
+
+static int mpc_profile_leave(mpc_input_t *i, mpc_profile_t *f, mpc_profile_frame_t *s, int x) {
+  f->active--;
+  if (x) { f->successes++; } else { f->failures++; }
+  if (f->active == 0) {
+    if (x) { f->bytes += i->state.pos - s->pos; }
+    f->rewinds += i->rewinds - s->rewinds;
+    f->time += clock() - s->start;
+  }
+  return x;
+}
+
+/*
+** With a step budget every parser invocation
+** counts as a step. Once the budget is spent
+** every further invocation fails at once so the
+** parse unwinds quickly, and the whole parse is
+** then reported as failed with its own error.
+*/
+
+static int mpc_input_step(mpc_input_t *i) {
+  i->steps++;
+  if (i->steps_limit == 0) { return 1; }
+  if (i->steps == i->steps_limit + 1) { i->steps_state = i->state; }
+  return i->steps <= i->steps_limit;
+}
+
+static int mpc_input_budget(mpc_input_t *i, mpc_result_t *r, int x) {
+  
+  mpc_err_t *e;
+  
+  if (i->steps_limit == 0 || i->steps <= i->steps_limit) { return x; }
+  
+  if (x) {
+    if (i->steps_dtor) { i->steps_dtor(r->output); }
+  } else {
+    mpc_err_delete(r->error);
+  }
+  
+  e = mpc_err_fail(i, "Parse step budget exhausted!");
+  e->state = i->steps_state;
+  r->error = mpc_err_export(i, e);
+  return 0;
+}
+
+static int mpc_parse_node(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  mpc_profile_frame_t s;
+  if (!mpc_input_step(i)) { r->error = NULL; return 0; }
+  if (p->profile == NULL) { return mpc_parse_node(i, p, r, e); }
+  mpc_profile_enter(i, p->profile, &s);
+  return mpc_profile_leave(i, p->profile, &s, mpc_parse_node(i, p, r, e));
+}
+
+static int mpc_parse_node(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
   int j = 0, k = 0;
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
@@ -1025,6 +1543,8 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
     case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
     case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    case MPC_TYPE_INT_LIT: MPC_PRIMITIVE(mpc_input_int_lit(i, (char**)&r->output));
+    case MPC_TYPE_CODEPOINT: MPC_PRIMITIVE(mpc_input_codepoint(i, p->data.codepoint.x, p->data.codepoint.n, p->data.codepoint.xs, (char**)&r->output));
     
     /* Other parsers */
     
@@ -1237,13 +1757,14 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e);
+  if (i->marks_peak > p->marks_peak) { p->marks_peak = i->marks_peak; }
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
     r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
   }
-  return x;
+  return mpc_input_budget(i, r, x);
 }
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
@@ -1295,47 +1816,324 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 }
 
 /*
-** Building a Parser
+** Parse Context
 */
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force);
+/*
+** A context owns a single string input which
+** is rebound to a new buffer on every call
+** rather than being created and destroyed.
+**
+** The buffer and filename are borrowed, not
+** copied, and must stay alive for the duration
+** of the call. The memory pool and mark stack
+** stay allocated between calls so parsing many
+** small inputs does no per-call setup work.
+*/
 
-static void mpc_undefine_or(mpc_parser_t *p) {
-  
-  int i;
-  for (i = 0; i < p->data.or.n; i++) {
-    mpc_undefine_unretained(p->data.or.xs[i], 0);
-  }
-  free(p->data.or.xs);
-  
+struct mpc_ctx_t {
+  mpc_input_t input;
+};
+
+mpc_ctx_t *mpc_ctx_new(void) {
+
+  mpc_ctx_t *c = malloc(sizeof(mpc_ctx_t));
+  mpc_input_t *i = &c->input;
+
+  i->filename = NULL;
+  i->type = MPC_INPUT_STRING;
+
+  i->string = NULL;
+  i->length = 0;
+  i->buffer = NULL;
+  i->file = NULL;
+
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
+
+  mpc_ctx_reset(c);
+
+  return c;
 }
 
-static void mpc_undefine_and(mpc_parser_t *p) {
-  
-  int i;
-  for (i = 0; i < p->data.and.n; i++) {
-    mpc_undefine_unretained(p->data.and.xs[i], 0);
-  }
-  free(p->data.and.xs);
-  free(p->data.and.dxs);
-  
+void mpc_ctx_delete(mpc_ctx_t *c) {
+  free(c->input.marks);
+  free(c);
 }
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
-  
-  if (p->retained && !force) { return; }
-  
-  switch (p->type) {
-    
-    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
-    
-    case MPC_TYPE_ONEOF: 
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      free(p->data.string.x); 
-      break;
-    
-    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
+void mpc_ctx_trim(mpc_ctx_t *c) {
+  mpc_input_marks_trim(&c->input);
+}
+
+/*
+** Limits every following parse with the context
+** to `steps` parser invocations, or removes the
+** limit when `steps` is zero. A parse which runs
+** out fails with a step budget error. If it had
+** succeeded regardless its output is destroyed
+** with `d`. The steps taken by the last parse
+** are counted with or without a limit so that
+** a limit can be chosen from typical inputs.
+** A recovering parse gives every form the whole
+** limit, and a form which runs out is skipped.
+*/
+
+void mpc_ctx_limit(mpc_ctx_t *c, unsigned long steps, mpc_dtor_t d) {
+  c->input.steps_limit = steps;
+  c->input.steps_dtor = d;
+}
+
+unsigned long mpc_ctx_steps(mpc_ctx_t *c) {
+  return c->input.steps;
+}
+
+void mpc_ctx_reset(mpc_ctx_t *c) {
+
+  mpc_input_t *i = &c->input;
+
+  i->state = mpc_state_new();
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->steps_limit = 0;
+  i->steps_dtor = NULL;
+  i->last = '\0';
+
+  i->mem_index = 0;
+  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+}
+
+static mpc_input_t *mpc_ctx_bind(mpc_ctx_t *c, const char *filename, const char *string, size_t length) {
+
+  mpc_input_t *i = &c->input;
+
+  i->filename = (char*)filename;
+  i->string = (char*)string;
+  i->length = length;
+
+  i->state = mpc_state_new();
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_peak = 0;
+  i->rewinds = 0;
+  i->steps = 0;
+  i->last = '\0';
+
+  return i;
+}
+
+int mpc_ctx_nparse(mpc_ctx_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_input(mpc_ctx_bind(c, filename, string, length), p, r);
+}
+
+int mpc_ctx_parse(mpc_ctx_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_ctx_nparse(c, filename, string, strlen(string), p, r);
+}
+
+/*
+** Error Recovery
+*/
+
+/*
+** Parses a sequence of `p` separated by
+** whitespace. When `p` fails its error is
+** recorded and the input is resynchronised
+** after the form it failed in, so a single
+** syntax error does not discard the rest of
+** a large input.
+**
+** The form is skipped from where `p` started.
+** If it begins with one of the opening
+** characters in `o` everything up to the
+** balancing character in `c` is skipped (or
+** up to the end of input). A stray closing
+** character is skipped on its own. Anything
+** else is skipped up to the next whitespace
+** or bracket.
+*/
+
+static int mpc_recover_in(const char *s, char x) {
+  return x != '\0' && strchr(s, x) != NULL;
+}
+
+static void mpc_recover_skip(mpc_input_t *i, const char *o, const char *c) {
+  
+  int depth = 0;
+  char x = mpc_input_peekc(i);
+  
+  if (mpc_recover_in(o, x)) {
+    while (!mpc_input_terminated(i)) {
+      x = mpc_input_peekc(i);
+      mpc_input_any(i, NULL);
+      if (mpc_recover_in(o, x)) { depth++; }
+      if (mpc_recover_in(c, x)) { depth--; }
+      if (depth == 0) { break; }
+    }
+    return;
+  }
+  
+  if (mpc_recover_in(c, x)) {
+    mpc_input_any(i, NULL);
+    return;
+  }
+  
+  while (!mpc_input_terminated(i)) {
+    x = mpc_input_peekc(i);
+    if (mpc_recover_in(" \f\n\r\t\v", x)
+    ||  mpc_recover_in(o, x)
+    ||  mpc_recover_in(c, x)) { break; }
+    mpc_input_any(i, NULL);
+  }
+}
+
+/*
+** A failed form holding bytes which are not
+** UTF-8 is reported at the first of them rather
+** than by what the grammar expected there.
+*/
+
+static void mpc_recover_utf8(mpc_input_t *i, mpc_state_t s, mpc_err_t **e) {
+  
+  mpc_state_t end = i->state;
+  char last = i->last;
+  long k = mpc_utf8_check(i->string + s.pos, end.pos - s.pos);
+  
+  if (k < 0) { return; }
+  
+  i->state = s;
+  mpc_input_advance(i, k);
+  mpc_err_delete(*e);
+  *e = mpc_err_export(i, mpc_err_new(i, "valid UTF-8"));
+  i->state = end;
+  i->last = last;
+}
+
+static int mpc_parse_input_recover(mpc_input_t *i, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r) {
+  
+  mpc_result_t x;
+  mpc_state_t s;
+  int failed;
+  
+  r->outputs_num = 0;
+  r->outputs = NULL;
+  r->errors_num = 0;
+  r->errors = NULL;
+  
+  while (1) {
+    
+    while (mpc_input_oneof(i, " \f\n\r\t\v", NULL));
+    if (mpc_input_terminated(i)) { break; }
+    
+    /* Each form has the whole step budget, if there is one */
+    s = i->state;
+    i->steps = 0;
+    failed = !mpc_parse_input(i, p, &x);
+    
+    if (!failed) {
+      r->outputs_num++;
+      r->outputs = realloc(r->outputs, sizeof(mpc_val_t*) * r->outputs_num);
+      r->outputs[r->outputs_num-1] = x.output;
+      if (i->state.pos > s.pos) { continue; }
+    } else {
+      r->errors_num++;
+      r->errors = realloc(r->errors, sizeof(mpc_err_t*) * r->errors_num);
+      r->errors[r->errors_num-1] = x.error;
+    }
+    
+    /* Failed, or succeeded without consuming anything */
+    i->state = s;
+    i->last = s.pos > 0 ? i->string[s.pos-1] : '\0';
+    mpc_recover_skip(i, o, c);
+    
+    if (failed) { mpc_recover_utf8(i, s, &r->errors[r->errors_num-1]); }
+  }
+  
+  return r->errors_num == 0;
+}
+
+int mpc_parse_recover(const char *filename, const char *string, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input_recover(i, p, o, c, r);
+  mpc_input_delete(i);
+  return x;
+}
+
+int mpc_nparse_recover(const char *filename, const char *string, size_t length, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
+  x = mpc_parse_input_recover(i, p, o, c, r);
+  mpc_input_delete(i);
+  return x;
+}
+
+int mpc_ctx_nparse_recover(mpc_ctx_t *x, const char *filename, const char *string, size_t length, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r) {
+  return mpc_parse_input_recover(mpc_ctx_bind(x, filename, string, length), p, o, c, r);
+}
+
+void mpc_recovery_clear(mpc_recovery_t *r, mpc_dtor_t d) {
+  int j;
+  for (j = 0; j < r->outputs_num; j++) { d(r->outputs[j]); }
+  for (j = 0; j < r->errors_num; j++) { mpc_err_delete(r->errors[j]); }
+  free(r->outputs);
+  free(r->errors);
+  r->outputs_num = 0;
+  r->outputs = NULL;
+  r->errors_num = 0;
+  r->errors = NULL;
+}
+
+/*
+** Building a Parser
+*/
+
+static void mpc_undefine_unretained(mpc_parser_t *p, int force);
+
+static void mpc_undefine_or(mpc_parser_t *p) {
+  
+  int i;
+  for (i = 0; i < p->data.or.n; i++) {
+    mpc_undefine_unretained(p->data.or.xs[i], 0);
+  }
+  free(p->data.or.xs);
+  
+}
+
+static void mpc_undefine_and(mpc_parser_t *p) {
+  
+  int i;
+  for (i = 0; i < p->data.and.n; i++) {
+    mpc_undefine_unretained(p->data.and.xs[i], 0);
+  }
+  free(p->data.and.xs);
+  free(p->data.and.dxs);
+  
+}
+
+static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
+  
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
+    
+    case MPC_TYPE_ONEOF: 
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      free(p->data.string.x); 
+      break;
+    
+    case MPC_TYPE_CODEPOINT:
+      free(p->data.codepoint.x);
+      free(p->data.codepoint.xs);
+      break;
+    
+    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
     
@@ -1362,6 +2160,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   }
   
   if (!force) {
+    free(p->profile);
     free(p->name);
     free(p);
   }
@@ -1375,6 +2174,7 @@ void mpc_delete(mpc_parser_t *p) {
       mpc_undefine_unretained(p, 0);
     } 
     
+    free(p->profile);
     free(p->name);
     free(p);
   
@@ -1433,6 +2233,13 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.string.x, a->data.string.x);
       break;
     
+    case MPC_TYPE_CODEPOINT:
+      p->data.codepoint.x = malloc(strlen(a->data.codepoint.x)+1);
+      strcpy(p->data.codepoint.x, a->data.codepoint.x);
+      p->data.codepoint.xs = malloc(sizeof(unsigned long) * 2 * a->data.codepoint.n);
+      memcpy(p->data.codepoint.xs, a->data.codepoint.xs, sizeof(unsigned long) * 2 * a->data.codepoint.n);
+      break;
+    
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
@@ -1893,6 +2700,12 @@ mpc_parser_t *mpc_float(void) {
   return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
 }
 
+mpc_parser_t *mpc_int_lit(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_INT_LIT;
+  return mpc_expect(p, "integer");
+}
+
 mpc_parser_t *mpc_char_lit(void) {
   return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
 }
@@ -2056,13 +2869,62 @@ static mpc_parser_t *mpc_re_escape_char(char c) {
   }
 }
 
+static mpc_parser_t *mpc_re_utf8_tail(void) {
+  return mpc_range('\x80', '\xBF');
+}
+
+/*
+** A whole codepoint. ASCII is tried first so it
+** costs a single comparison, and bytes which are
+** not valid UTF-8 still match one at a time.
+*/
+
+static mpc_parser_t *mpc_re_utf8_any(void) {
+  return mpc_expect(mpc_or(5,
+    mpc_range('\x00', '\x7F'),
+    mpc_and(2, mpcf_strfold, mpc_range('\xC2', '\xDF'),
+      mpc_re_utf8_tail(), free),
+    mpc_and(3, mpcf_strfold, mpc_range('\xE0', '\xEF'),
+      mpc_re_utf8_tail(), mpc_re_utf8_tail(), free, free),
+    mpc_and(4, mpcf_strfold, mpc_range('\xF0', '\xF4'),
+      mpc_re_utf8_tail(), mpc_re_utf8_tail(), mpc_re_utf8_tail(), free, free, free),
+    mpc_any()), "any character");
+}
+
+/*
+** The single bytes in `c` and the codepoints
+** in `n` ranges from `los` to `his`, matched as
+** a single step however many bytes they take
+** rather than by ranges over each encoded byte.
+*/
+
+static mpc_parser_t *mpc_re_codepoints(const char *c, const unsigned long *los, const unsigned long *his, int n) {
+  
+  mpc_parser_t *p = mpc_undefined();
+  int j, k = 0;
+  
+  p->type = MPC_TYPE_CODEPOINT;
+  p->data.codepoint.x = malloc(strlen(c) + 1);
+  strcpy(p->data.codepoint.x, c);
+  p->data.codepoint.xs = malloc(sizeof(unsigned long) * 2 * (n > 0 ? n : 1));
+  for (j = 0; j < n; j++) {
+    if (los[j] > his[j] || los[j] > 0x10FFFF) { continue; }
+    p->data.codepoint.xs[2*k] = los[j];
+    p->data.codepoint.xs[2*k+1] = his[j] > 0x10FFFF ? 0x10FFFF : his[j];
+    k++;
+  }
+  p->data.codepoint.n = k;
+  
+  return p;
+}
+
 static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
   
   char *s = x;
   mpc_parser_t *p;
   
   /* Regex Special Characters */
-  if (s[0] == '.') { free(s); return mpc_any(); }
+  if (s[0] == '.') { free(s); return mpc_re_utf8_any(); }
   if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
   if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
   
@@ -2074,6 +2936,13 @@ static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
     return p;
   }
   
+  /* Regex Multibyte Character */
+  if (s[0] != '\0' && s[1] != '\0') {
+    p = mpc_string(s);
+    free(s);
+    return p;
+  }
+  
   /* Regex Standard */
   p = mpc_char(s[0]);
   free(s);
@@ -2097,6 +2966,105 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
+/*
+** Ranges holding any multibyte character are built
+** from the codepoints in them. Their ASCII part is
+** still looked up as with `oneof`, bytes not valid
+** as UTF-8 are kept as single characters, and the
+** whole range is matched by a single parser.
+*/
+
+static mpc_parser_t *mpc_re_range_utf8(const char *s, int comp) {
+  
+  mpc_parser_t *out = NULL;
+  unsigned long *los = NULL, *his = NULL;
+  unsigned long c, prev = 0;
+  const char *tmp;
+  long n = (long)strlen(s);
+  long i = comp;
+  int len, ranges_num = 0, ascii_num = 0, has_prev = 0;
+  char bytes[256];
+  char ascii[256];
+  
+  memset(bytes, 0, sizeof(bytes));
+  
+  while (i < n) {
+    
+    /* Regex Range Escape */
+    if (s[i] == '\\' && i + 1 < n) {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        while (*tmp) { bytes[(unsigned char)*tmp++] = 1; }
+        has_prev = 0;
+        i += 2;
+        continue;
+      }
+      i++;
+    }
+    
+    /* Regex Range...Range */
+    else if (s[i] == '-' && has_prev && i + 1 < n) {
+      len = mpc_utf8_decode(s + i + 1, n - i - 1, &c);
+      if (len > 0 && c >= prev) {
+        los = realloc(los, sizeof(unsigned long) * (ranges_num + 1));
+        his = realloc(his, sizeof(unsigned long) * (ranges_num + 1));
+        los[ranges_num] = prev;
+        his[ranges_num] = c;
+        ranges_num++;
+        has_prev = 0;
+        i += 1 + len;
+        continue;
+      }
+    }
+    
+    /* Regex Range Normal */
+    len = mpc_utf8_decode(s + i, n - i, &c);
+    if (len <= 1) {
+      bytes[(unsigned char)s[i]] = 1;
+      has_prev = (len == 1);
+      prev = c;
+      i++;
+      continue;
+    }
+    
+    los = realloc(los, sizeof(unsigned long) * (ranges_num + 1));
+    his = realloc(his, sizeof(unsigned long) * (ranges_num + 1));
+    los[ranges_num] = his[ranges_num] = c;
+    ranges_num++;
+    has_prev = 1;
+    prev = c;
+    i += len;
+  }
+  
+  /* The ASCII part of ranges joins the single bytes */
+  for (i = 0; i < ranges_num; i++) {
+    for (c = los[i]; c <= his[i] && c < 0x80; c++) { bytes[c] = 1; }
+    if (los[i] < 0x80) { los[i] = 0x80; }
+  }
+  
+  for (c = 1; c < 256; c++) {
+    if (bytes[c]) { ascii[ascii_num++] = (char)c; }
+  }
+  ascii[ascii_num] = '\0';
+  
+  if (ascii_num > 0 || ranges_num > 0) {
+    out = mpc_re_codepoints(ascii, los, his, ranges_num);
+  }
+  
+  free(los);
+  free(his);
+  
+  if (out == NULL) { return mpc_fail("Invalid Regex Range Expression"); }
+  
+  /* Any single codepoint outside of the range */
+  if (comp) {
+    return mpc_expectf(mpc_and(2, mpcf_snd,
+      mpc_not(out, free), mpc_re_utf8_any(), free), "none of '%s'", s + comp);
+  }
+  
+  return mpc_expectf(out, "one of '%s'", s);
+}
+
 static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   mpc_parser_t *out;
@@ -2111,6 +3079,15 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   if (s[0] == '^' && 
       s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
   
+  for (i = comp; s[i] != '\0'; i++) {
+    if ((unsigned char)s[i] >= 0x80) {
+      out = mpc_re_range_utf8(s, comp);
+      free(x);
+      free(range);
+      return out;
+    }
+  }
+  
   for (i = comp; i < strlen(s); i++){
     
     /* Regex Range Escape */
@@ -2190,10 +3167,13 @@ mpc_parser_t *mpc_re(const char *re) {
     (mpc_dtor_t)mpc_delete
   ));
   
-  mpc_define(Base, mpc_or(4,
+  mpc_define(Base, mpc_or(5,
     mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
     mpc_squares(Range, (mpc_dtor_t)mpc_delete),
     mpc_apply(mpc_escape(), mpcf_re_escape),
+    mpc_apply(mpc_and(2, mpcf_strfold,
+      mpc_range('\xC2', '\xF4'),
+      mpc_many1(mpcf_strfold, mpc_re_utf8_tail()), free), mpcf_re_escape),
     mpc_apply(mpc_noneof(")|"), mpcf_re_escape)
   ));
   
@@ -2511,6 +3491,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
+  if (p->type == MPC_TYPE_INT_LIT) { printf("<int>"); }
+  if (p->type == MPC_TYPE_CODEPOINT) { printf("<utf8>"); }
 
   if (p->type == MPC_TYPE_SINGLE) {
     buff[0] = p->data.single.x; buff[1] = '\0';
@@ -2750,6 +3732,7 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   
   int i;
 
+  if (a == b) { return 1; }
   if (strcmp(a->tag, b->tag) != 0) { return 0; }
   if (strcmp(a->contents, b->contents) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
@@ -2761,74 +3744,309 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   return 1;
 }
 
-mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
-  return r;
+static unsigned long mpc_hash_string(unsigned long h, const char *s) {
+  while (*s) { h = (h ^ (unsigned char)*s++) * 16777619UL; }
+  return (h ^ 0xff) * 16777619UL;
 }
 
-mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
-  return a;
+static unsigned long mpc_hash_word(unsigned long h, unsigned long x) {
+  int i;
+  for (i = 0; i < (int)sizeof(unsigned long); i++) {
+    h = (h ^ (x & 0xff)) * 16777619UL;
+    x >>= 8;
+  }
+  return h;
 }
 
-mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
-  return a;
-}
+/*
+** Structural hash of a tree. Like `mpc_ast_eq`
+** it ignores the `state` member, so trees which
+** are equal always have the same hash.
+*/
 
-mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+unsigned long mpc_ast_hash(mpc_ast_t *a) {
+  int i;
+  unsigned long h = 2166136261UL;
+  h = mpc_hash_string(h, a->tag);
+  h = mpc_hash_string(h, a->contents);
+  for (i = 0; i < a->children_num; i++) {
+    h = mpc_hash_word(h, mpc_ast_hash(a->children[i]));
+  }
+  return h;
 }
 
-mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
-  if (a == NULL) { return a; }
-  a->state = s;
-  return a;
-}
+/*
+** Hash Consing
+**
+** A table of canonical nodes in which equal
+** subtrees are only stored once. Passing a tree
+** to `mpc_ast_cons` replaces every subtree with
+** its canonical copy, freeing the duplicates,
+** and returns the canonical root. Canonical
+** trees are equal exactly when their roots are
+** the same pointer, so `mpc_ast_eq` on them is
+** constant time.
+**
+** Canonical nodes are shared so they belong to
+** the table. They must not be changed or passed
+** to `mpc_ast_delete` and are all freed by
+** `mpc_ast_cons_delete`. Shared nodes keep the
+** `state` of the first tree they came from.
+*/
 
-static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
-  
-  int i;
-  
-  if (a == NULL) {
-    fprintf(fp, "NULL\n");
-    return;
+typedef struct {
+  unsigned long hash;
+  mpc_ast_t *ast;
+} mpc_ast_cons_entry_t;
+
+struct mpc_ast_cons_t {
+  int num;
+  int slots;
+  mpc_ast_cons_entry_t *entries;
+};
+
+enum {
+  MPC_AST_CONS_MIN = 64
+};
+
+mpc_ast_cons_t *mpc_ast_cons_new(void) {
+  mpc_ast_cons_t *c = malloc(sizeof(mpc_ast_cons_t));
+  c->num = 0;
+  c->slots = MPC_AST_CONS_MIN;
+  c->entries = calloc(c->slots, sizeof(mpc_ast_cons_entry_t));
+  return c;
+}
+
+void mpc_ast_cons_delete(mpc_ast_cons_t *c) {
+  int i;
+  for (i = 0; i < c->slots; i++) {
+    if (c->entries[i].ast) { mpc_ast_delete_no_children(c->entries[i].ast); }
+  }
+  free(c->entries);
+  free(c);
+}
+
+int mpc_ast_cons_num(mpc_ast_cons_t *c) {
+  return c->num;
+}
+
+/* Children are canonical already so are compared by pointer */
+static unsigned long mpc_ast_cons_hash(mpc_ast_t *a) {
+  int i;
+  unsigned long h = 2166136261UL;
+  h = mpc_hash_string(h, a->tag);
+  h = mpc_hash_string(h, a->contents);
+  for (i = 0; i < a->children_num; i++) {
+    h = mpc_hash_word(h, (unsigned long)(size_t)a->children[i]);
+  }
+  return h;
+}
+
+static int mpc_ast_cons_eq(mpc_ast_t *a, mpc_ast_t *b) {
+  int i;
+  if (a->children_num != b->children_num) { return 0; }
+  if (strcmp(a->tag, b->tag) != 0) { return 0; }
+  if (strcmp(a->contents, b->contents) != 0) { return 0; }
+  for (i = 0; i < a->children_num; i++) {
+    if (a->children[i] != b->children[i]) { return 0; }
+  }
+  return 1;
+}
+
+static void mpc_ast_cons_insert(mpc_ast_cons_t *c, unsigned long h, mpc_ast_t *a) {
+  int i = (int)(h & (unsigned long)(c->slots - 1));
+  while (c->entries[i].ast) { i = (i + 1) & (c->slots - 1); }
+  c->entries[i].hash = h;
+  c->entries[i].ast = a;
+}
+
+static void mpc_ast_cons_grow(mpc_ast_cons_t *c) {
+  
+  int i, slots = c->slots;
+  mpc_ast_cons_entry_t *entries = c->entries;
+  
+  c->slots = c->slots * 2;
+  c->entries = calloc(c->slots, sizeof(mpc_ast_cons_entry_t));
+  for (i = 0; i < slots; i++) {
+    if (entries[i].ast) { mpc_ast_cons_insert(c, entries[i].hash, entries[i].ast); }
+  }
+  free(entries);
+}
+
+mpc_ast_t *mpc_ast_cons(mpc_ast_cons_t *c, mpc_ast_t *a) {
+  
+  int i;
+  unsigned long h;
+  mpc_ast_cons_entry_t *e;
+  
+  if (a == NULL) { return NULL; }
+  
+  for (i = 0; i < a->children_num; i++) {
+    a->children[i] = mpc_ast_cons(c, a->children[i]);
+  }
+  
+  h = mpc_ast_cons_hash(a);
+  
+  i = (int)(h & (unsigned long)(c->slots - 1));
+  while (c->entries[i].ast) {
+    e = &c->entries[i];
+    if (e->ast == a) { return a; }
+    if (e->hash == h && mpc_ast_cons_eq(e->ast, a)) {
+      mpc_ast_delete_no_children(a);
+      return e->ast;
+    }
+    i = (i + 1) & (c->slots - 1);
+  }
+  
+  if (2 * (c->num + 1) > c->slots) { mpc_ast_cons_grow(c); }
+  mpc_ast_cons_insert(c, h, a);
+  c->num++;
+  
+  return a;
+}
+
+mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  r->children_num++;
+  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+  r->children[r->children_num-1] = a;
+  return r;
+}
+
+mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
+  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, strlen(t));
+  memmove(a->tag + strlen(t), "|", 1);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
+  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, (strlen(t)-1));
+  return a;
+}
+
+mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  a->tag = realloc(a->tag, strlen(t) + 1);
+  strcpy(a->tag, t);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
+  if (a == NULL) { return a; }
+  a->state = s;
+  return a;
+}
+
+static void mpc_ast_print_contents(mpc_ast_t *a, mpc_buf_t *b, int compact) {
+  
+  char *s, *r;
+  
+  if (!compact) { mpc_buf_puts(b, a->contents); return; }
+  
+  /* Compact output must stay on one line */
+  for (s = r = a->contents; *s; s++) {
+    switch (*s) {
+      case '\n': mpc_buf_putn(b, r, s - r); mpc_buf_puts(b, "\\n"); r = s+1; break;
+      case '\r': mpc_buf_putn(b, r, s - r); mpc_buf_puts(b, "\\r"); r = s+1; break;
+      case '\t': mpc_buf_putn(b, r, s - r); mpc_buf_puts(b, "\\t"); r = s+1; break;
+      case '\\': mpc_buf_putn(b, r, s - r); mpc_buf_puts(b, "\\\\"); r = s+1; break;
+      case '\'': mpc_buf_putn(b, r, s - r); mpc_buf_puts(b, "\\'"); r = s+1; break;
+      default: break;
+    }
   }
+  mpc_buf_putn(b, r, s - r);
+}
+
+static void mpc_ast_print_depth(mpc_ast_t *a, int d, mpc_buf_t *b) {
+  
+  int i;
   
-  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+  if (a == NULL) {
+    mpc_buf_puts(b, "NULL\n");
+    return;
+  }
   
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag, 
-      (long unsigned int)(a->state.row+1),
-      (long unsigned int)(a->state.col+1),
-      a->contents);
+  mpc_buf_fill(b, ' ', 2 * (size_t)d);
+  
+  if (a->contents[0]) {
+    mpc_buf_puts(b, a->tag);
+    mpc_buf_putc(b, ':');
+    mpc_buf_putl(b, a->state.row+1);
+    mpc_buf_putc(b, ':');
+    mpc_buf_putl(b, a->state.col+1);
+    mpc_buf_puts(b, " '");
+    mpc_ast_print_contents(a, b, 0);
+    mpc_buf_puts(b, "'\n");
   } else {
-    fprintf(fp, "%s \n", a->tag);
+    mpc_buf_puts(b, a->tag);
+    mpc_buf_puts(b, " \n");
+  }
+  
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_print_depth(a->children[i], d+1, b);
+  }
+  
+}
+
+/*
+** The compact form writes leaves as `tag:row:col 'contents'`
+** and branches as `(tag child child ...)` all on a single line.
+*/
+
+static void mpc_ast_print_compact(mpc_ast_t *a, mpc_buf_t *b) {
+  
+  int i;
+  
+  if (a == NULL) {
+    mpc_buf_puts(b, "NULL");
+    return;
   }
   
+  if (a->children_num == 0) {
+    mpc_buf_puts(b, a->tag);
+    mpc_buf_putc(b, ':');
+    mpc_buf_putl(b, a->state.row+1);
+    mpc_buf_putc(b, ':');
+    mpc_buf_putl(b, a->state.col+1);
+    mpc_buf_puts(b, " '");
+    mpc_ast_print_contents(a, b, 1);
+    mpc_buf_putc(b, '\'');
+    return;
+  }
+  
+  mpc_buf_putc(b, '(');
+  mpc_buf_puts(b, a->tag);
   for (i = 0; i < a->children_num; i++) {
-    mpc_ast_print_depth(a->children[i], d+1, fp);
+    mpc_buf_putc(b, ' ');
+    mpc_ast_print_compact(a->children[i], b);
   }
+  mpc_buf_putc(b, ')');
   
 }
 
+void mpc_ast_print_buf(mpc_ast_t *a, mpc_buf_t *b, int compact) {
+  if (compact) {
+    mpc_ast_print_compact(a, b);
+    mpc_buf_putc(b, '\n');
+  } else {
+    mpc_ast_print_depth(a, 0, b);
+  }
+}
+
 void mpc_ast_print(mpc_ast_t *a) {
-  mpc_ast_print_depth(a, 0, stdout);
+  mpc_ast_print_to(a, stdout);
 }
 
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
-  mpc_ast_print_depth(a, 0, fp);
+  mpc_buf_t b;
+  mpc_buf_init(&b);
+  mpc_ast_print_depth(a, 0, &b);
+  mpc_buf_write(&b, fp);
+  mpc_buf_free(&b);
 }
 
 int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
@@ -2999,6 +4217,152 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
   }
 }
 
+/*
+** The iterator keeps its path from the root in
+** a stack of frames supplied by the caller, so
+** it never allocates. A tree deeper than the
+** stack stops the iteration and sets the
+** `overflow` flag. `mpc_ast_depth` gives the
+** number of frames a tree needs.
+*/
+
+int mpc_ast_depth(mpc_ast_t *a) {
+  int i, d, max = 0;
+  for (i = 0; i < a->children_num; i++) {
+    d = mpc_ast_depth(a->children[i]);
+    if (d > max) { max = d; }
+  }
+  return max + 1;
+}
+
+void mpc_ast_iter_init(mpc_ast_iter_t *it, mpc_ast_t *ast, mpc_ast_trav_order_t order,
+                       mpc_ast_frame_t *frames, int frames_num) {
+  it->order = order;
+  it->frames = frames;
+  it->frames_num = frames_num;
+  it->depth = 0;
+  it->overflow = 0;
+  if (ast == NULL) { return; }
+  if (frames_num < 1) { it->overflow = 1; return; }
+  frames[0].node = ast;
+  frames[0].child = -1;
+  it->depth = 1;
+}
+
+mpc_ast_t *mpc_ast_iter_next(mpc_ast_iter_t *it) {
+  
+  mpc_ast_frame_t *f;
+  
+  while (it->depth > 0) {
+    
+    f = &it->frames[it->depth-1];
+    
+    /* First visit */
+    if (f->child == -1) {
+      f->child = 0;
+      if (it->order == mpc_ast_trav_order_pre) { return f->node; }
+    }
+    
+    /* Descend into the next child */
+    if (f->child < f->node->children_num) {
+      if (it->depth == it->frames_num) {
+        it->overflow = 1;
+        it->depth = 0;
+        return NULL;
+      }
+      it->frames[it->depth].node = f->node->children[f->child++];
+      it->frames[it->depth].child = -1;
+      it->depth++;
+      continue;
+    }
+    
+    /* Last visit */
+    it->depth--;
+    if (it->order == mpc_ast_trav_order_post) { return f->node; }
+  }
+  
+  return NULL;
+}
+
+/*
+** An index of the children of a single node by
+** tag. Entries are sorted by tag and then by
+** position so a lookup is a binary search. It
+** must be rebuilt if the children change.
+*/
+
+typedef struct {
+  const char *tag;
+  int index;
+} mpc_ast_index_entry_t;
+
+struct mpc_ast_index_t {
+  mpc_ast_t *ast;
+  int entries_num;
+  mpc_ast_index_entry_t *entries;
+};
+
+static int mpc_ast_index_cmp(const void *x, const void *y) {
+  const mpc_ast_index_entry_t *a = x;
+  const mpc_ast_index_entry_t *b = y;
+  int c = strcmp(a->tag, b->tag);
+  if (c != 0) { return c; }
+  return a->index - b->index;
+}
+
+mpc_ast_index_t *mpc_ast_index_new(mpc_ast_t *ast) {
+  
+  int i;
+  mpc_ast_index_t *x = malloc(sizeof(mpc_ast_index_t));
+  
+  x->ast = ast;
+  x->entries_num = ast->children_num;
+  x->entries = malloc(sizeof(mpc_ast_index_entry_t) * (ast->children_num + 1));
+  
+  for (i = 0; i < ast->children_num; i++) {
+    x->entries[i].tag = ast->children[i]->tag;
+    x->entries[i].index = i;
+  }
+  
+  qsort(x->entries, x->entries_num, sizeof(mpc_ast_index_entry_t), mpc_ast_index_cmp);
+  
+  return x;
+}
+
+void mpc_ast_index_delete(mpc_ast_index_t *x) {
+  free(x->entries);
+  free(x);
+}
+
+int mpc_ast_index_get_lb(mpc_ast_index_t *x, const char *tag, int lb) {
+  
+  int lo = 0, hi = x->entries_num, mid, c;
+  
+  /* First entry not less than (tag, lb) */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    c = strcmp(x->entries[mid].tag, tag);
+    if (c < 0 || (c == 0 && x->entries[mid].index < lb)) { lo = mid + 1; }
+    else { hi = mid; }
+  }
+  
+  if (lo == x->entries_num || strcmp(x->entries[lo].tag, tag) != 0) { return -1; }
+  return x->entries[lo].index;
+}
+
+int mpc_ast_index_get(mpc_ast_index_t *x, const char *tag) {
+  return mpc_ast_index_get_lb(x, tag, 0);
+}
+
+mpc_ast_t *mpc_ast_index_child_lb(mpc_ast_index_t *x, const char *tag, int lb) {
+  int i = mpc_ast_index_get_lb(x, tag, lb);
+  return i == -1 ? NULL : x->ast->children[i];
+}
+
+mpc_ast_t *mpc_ast_index_child(mpc_ast_index_t *x, const char *tag) {
+  return mpc_ast_index_child_lb(x, tag, 0);
+}
+
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   
   int i, j;
@@ -3667,6 +5031,538 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Mark Stack Peak: %i\n", p->marks_peak);
+  if (p->profile) {
+    printf("\n");
+    mpc_profile_print(p);
+  }
+}
+
+/*
+** Profiling
+*/
+
+/*
+** Returns the children of a parser as an array
+** which points into the parser itself.
+*/
+
+static int mpc_children(mpc_parser_t *p, mpc_parser_t ***xs) {
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:   *xs = &p->data.expect.x;   return 1;
+    case MPC_TYPE_APPLY:    *xs = &p->data.apply.x;    return 1;
+    case MPC_TYPE_APPLY_TO: *xs = &p->data.apply_to.x; return 1;
+    case MPC_TYPE_PREDICT:  *xs = &p->data.predict.x;  return 1;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:    *xs = &p->data.not.x;      return 1;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:    *xs = &p->data.repeat.x;   return 1;
+    case MPC_TYPE_OR:       *xs = p->data.or.xs;       return p->data.or.n;
+    case MPC_TYPE_AND:      *xs = p->data.and.xs;      return p->data.and.n;
+    default:                *xs = NULL;                return 0;
+  }
+}
+
+/*
+** Collects every retained parser reachable from
+** `p` (including `p`) in the order they are
+** first reached.
+*/
+
+static void mpc_retained_collect(mpc_parser_t *p, mpc_parser_t ***ps, int *n) {
+  
+  int j, m;
+  mpc_parser_t **xs;
+  
+  if (p->retained) {
+    for (j = 0; j < *n; j++) {
+      if ((*ps)[j] == p) { return; }
+    }
+    *ps = realloc(*ps, sizeof(mpc_parser_t*) * (*n + 1));
+    (*ps)[(*n)++] = p;
+  }
+  
+  m = mpc_children(p, &xs);
+  for (j = 0; j < m; j++) {
+    mpc_retained_collect(xs[j], ps, n);
+  }
+}
+
+/*
+** Profiling is enabled on every named parser
+** reachable from `p` and only costs a pointer
+** check per parser when it is disabled. Enabling
+** it again resets the counters.
+*/
+
+void mpc_profile_enable(mpc_parser_t *p) {
+  
+  int j, n = 0;
+  mpc_parser_t **ps = NULL;
+  
+  mpc_retained_collect(p, &ps, &n);
+  for (j = 0; j < n; j++) {
+    if (ps[j]->profile == NULL) { ps[j]->profile = malloc(sizeof(mpc_profile_t)); }
+    memset(ps[j]->profile, 0, sizeof(mpc_profile_t));
+  }
+  free(ps);
+}
+
+void mpc_profile_disable(mpc_parser_t *p) {
+  
+  int j, n = 0;
+  mpc_parser_t **ps = NULL;
+  
+  mpc_retained_collect(p, &ps, &n);
+  for (j = 0; j < n; j++) {
+    free(ps[j]->profile);
+    ps[j]->profile = NULL;
+  }
+  free(ps);
+}
+
+static double mpc_profile_ms(clock_t t) {
+  return 1000.0 * (double)t / CLOCKS_PER_SEC;
+}
+
+void mpc_profile_print_to(mpc_parser_t *p, FILE *fp) {
+  
+  int j, n = 0;
+  mpc_parser_t **ps = NULL;
+  mpc_profile_t *f;
+  
+  mpc_retained_collect(p, &ps, &n);
+  
+  fprintf(fp, "Profile\n");
+  fprintf(fp, "=======\n");
+  fprintf(fp, "%-20s %12s %12s %12s %12s %12s %12s\n",
+    "Parser", "Calls", "Successes", "Failures", "Rewinds", "Bytes", "Time (ms)");
+  
+  for (j = 0; j < n; j++) {
+    f = ps[j]->profile;
+    if (f == NULL) { continue; }
+    fprintf(fp, "%-20s %12lu %12lu %12lu %12lu %12lu %12.3f\n",
+      ps[j]->name, f->invocations, f->successes, f->failures,
+      f->rewinds, f->bytes, mpc_profile_ms(f->time));
+  }
+  
+  free(ps);
+}
+
+void mpc_profile_print(mpc_parser_t *p) {
+  mpc_profile_print_to(p, stdout);
+}
+
+void mpc_profile_print_json_to(mpc_parser_t *p, FILE *fp) {
+  
+  int j, n = 0, first = 1;
+  mpc_parser_t **ps = NULL;
+  mpc_profile_t *f;
+  const char *c;
+  
+  mpc_retained_collect(p, &ps, &n);
+  
+  fprintf(fp, "[");
+  for (j = 0; j < n; j++) {
+    f = ps[j]->profile;
+    if (f == NULL) { continue; }
+    
+    fprintf(fp, first ? "\n  {\"name\": \"" : ",\n  {\"name\": \"");
+    for (c = ps[j]->name; *c; c++) {
+      if (*c == '"' || *c == '\\') { fputc('\\', fp); }
+      fputc(*c, fp);
+    }
+    fprintf(fp,
+      "\", \"invocations\": %lu, \"successes\": %lu, \"failures\": %lu"
+      ", \"rewinds\": %lu, \"bytes\": %lu, \"time_ms\": %.3f}",
+      f->invocations, f->successes, f->failures,
+      f->rewinds, f->bytes, mpc_profile_ms(f->time));
+    first = 0;
+  }
+  fprintf(fp, first ? "]\n" : "\n]\n");
+  
+  free(ps);
+}
+
+/*
+** Analysis
+*/
+
+/*
+** `mpc_analyse` looks for grammar constructs
+** which either never terminate or can make
+** the parser backtrack excessively.
+**
+** - Undefined parsers, which always fail.
+** - Left recursive rules, which recurse without
+**   consuming input until the stack overflows.
+** - Repetitions of parsers which can succeed on
+**   empty input, which loop forever.
+** - Alternatives which can match empty input and
+**   so may hide the alternatives after them.
+** - Alternatives which can start with the same
+**   character. These are the source of repeated
+**   backtracking, which nested inside other such
+**   alternatives or repetitions is exponential.
+**
+** It computes which parsers can match empty
+** input and the set of characters each can
+** start with, iterating over the whole graph
+** until neither changes. Conditions checked by
+** `satisfy` functions are assumed to accept
+** any character.
+*/
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_parser_t **nodes;
+  mpc_parser_t **rules;
+  int *table;
+  int table_slots;
+  char *nullable;
+  unsigned char *first;
+  char *seen;
+  int issues;
+} mpc_analysis_t;
+
+static int mpc_analysis_find(mpc_analysis_t *a, mpc_parser_t *p) {
+  int h = (int)(((size_t)p >> 4) & (size_t)(a->table_slots - 1));
+  while (a->table[h] != 0) {
+    if (a->nodes[a->table[h]-1] == p) { return a->table[h]-1; }
+    h = (h + 1) & (a->table_slots - 1);
+  }
+  return -1;
+}
+
+static void mpc_analysis_insert(mpc_analysis_t *a, mpc_parser_t *p, int x) {
+  int h = (int)(((size_t)p >> 4) & (size_t)(a->table_slots - 1));
+  while (a->table[h] != 0) { h = (h + 1) & (a->table_slots - 1); }
+  a->table[h] = x + 1;
+}
+
+static void mpc_analysis_add(mpc_analysis_t *a, mpc_parser_t *p, mpc_parser_t *rule) {
+  
+  int j, m;
+  mpc_parser_t **xs;
+  
+  if (mpc_analysis_find(a, p) != -1) { return; }
+  
+  if (p->retained) { rule = p; }
+  
+  if (a->num == a->slots) {
+    a->slots = a->slots * 2;
+    a->nodes = realloc(a->nodes, sizeof(mpc_parser_t*) * a->slots);
+    a->rules = realloc(a->rules, sizeof(mpc_parser_t*) * a->slots);
+  }
+  
+  if (2 * (a->num + 1) > a->table_slots) {
+    free(a->table);
+    a->table_slots = a->table_slots * 2;
+    a->table = calloc(a->table_slots, sizeof(int));
+    for (j = 0; j < a->num; j++) { mpc_analysis_insert(a, a->nodes[j], j); }
+  }
+  
+  a->nodes[a->num] = p;
+  a->rules[a->num] = rule;
+  mpc_analysis_insert(a, p, a->num);
+  a->num++;
+  
+  m = mpc_children(p, &xs);
+  for (j = 0; j < m; j++) {
+    mpc_analysis_add(a, xs[j], rule);
+  }
+}
+
+static void mpc_analysis_char(unsigned char *f, unsigned char c) {
+  f[c / 8] |= (unsigned char)(1 << (c % 8));
+}
+
+static int mpc_analysis_has(const unsigned char *f, unsigned char c) {
+  return (f[c / 8] >> (c % 8)) & 1;
+}
+
+static int mpc_analysis_union(unsigned char *f, const unsigned char *g) {
+  int j, changed = 0;
+  for (j = 0; j < 32; j++) {
+    if ((f[j] | g[j]) != f[j]) { f[j] |= g[j]; changed = 1; }
+  }
+  return changed;
+}
+
+static int mpc_analysis_nullable(mpc_analysis_t *a, mpc_parser_t *p) {
+  
+  int j, m;
+  mpc_parser_t **xs;
+  
+  switch (p->type) {
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:
+      return 1;
+    
+    case MPC_TYPE_STRING: return p->data.string.x[0] == '\0';
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.n == 0
+        || a->nullable[mpc_analysis_find(a, p->data.repeat.x)];
+    
+    case MPC_TYPE_EXPECT:
+    case MPC_TYPE_APPLY:
+    case MPC_TYPE_APPLY_TO:
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_MANY1:
+      mpc_children(p, &xs);
+      return a->nullable[mpc_analysis_find(a, xs[0])];
+    
+    case MPC_TYPE_OR:
+      m = mpc_children(p, &xs);
+      for (j = 0; j < m; j++) {
+        if (a->nullable[mpc_analysis_find(a, xs[j])]) { return 1; }
+      }
+      return 0;
+    
+    case MPC_TYPE_AND:
+      m = mpc_children(p, &xs);
+      for (j = 0; j < m; j++) {
+        if (!a->nullable[mpc_analysis_find(a, xs[j])]) { return 0; }
+      }
+      return 1;
+    
+    default: return 0;
+  }
+}
+
+static void mpc_analysis_first(mpc_analysis_t *a, mpc_parser_t *p, unsigned char *f) {
+  
+  int j, m, x;
+  const char *c;
+  mpc_parser_t **xs;
+  
+  switch (p->type) {
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY:
+      for (j = 1; j < 256; j++) { mpc_analysis_char(f, (unsigned char)j); }
+      break;
+    
+    case MPC_TYPE_INT_LIT:
+      for (j = '0'; j <= '9'; j++) { mpc_analysis_char(f, (unsigned char)j); }
+      mpc_analysis_char(f, (unsigned char)'-');
+      break;
+    
+    case MPC_TYPE_CODEPOINT:
+      for (c = p->data.codepoint.x; *c; c++) { mpc_analysis_char(f, (unsigned char)*c); }
+      for (j = 0xC2; j < 0xF5 && p->data.codepoint.n > 0; j++) { mpc_analysis_char(f, (unsigned char)j); }
+      break;
+    
+    case MPC_TYPE_SINGLE: mpc_analysis_char(f, (unsigned char)p->data.single.x); break;
+    case MPC_TYPE_RANGE:
+      for (j = (unsigned char)p->data.range.x; j <= (unsigned char)p->data.range.y; j++) {
+        mpc_analysis_char(f, (unsigned char)j);
+      }
+      break;
+    
+    case MPC_TYPE_ONEOF:
+      for (c = p->data.string.x; *c; c++) { mpc_analysis_char(f, (unsigned char)*c); }
+      break;
+    
+    case MPC_TYPE_NONEOF:
+      for (j = 1; j < 256; j++) {
+        if (!strchr(p->data.string.x, j)) { mpc_analysis_char(f, (unsigned char)j); }
+      }
+      break;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0]) { mpc_analysis_char(f, (unsigned char)p->data.string.x[0]); }
+      break;
+    
+    case MPC_TYPE_EXPECT:
+    case MPC_TYPE_APPLY:
+    case MPC_TYPE_APPLY_TO:
+    case MPC_TYPE_PREDICT:
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+    case MPC_TYPE_OR:
+      m = mpc_children(p, &xs);
+      for (j = 0; j < m; j++) {
+        mpc_analysis_union(f, a->first + 32 * mpc_analysis_find(a, xs[j]));
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      m = mpc_children(p, &xs);
+      for (j = 0; j < m; j++) {
+        x = mpc_analysis_find(a, xs[j]);
+        mpc_analysis_union(f, a->first + 32 * x);
+        if (!a->nullable[x]) { break; }
+      }
+      break;
+    
+    default: break;
+  }
+}
+
+static void mpc_analysis_solve(mpc_analysis_t *a) {
+  
+  int j, changed;
+  unsigned char f[32];
+  
+  do {
+    changed = 0;
+    for (j = 0; j < a->num; j++) {
+      if (!a->nullable[j] && mpc_analysis_nullable(a, a->nodes[j])) {
+        a->nullable[j] = 1;
+        changed = 1;
+      }
+    }
+  } while (changed);
+  
+  do {
+    changed = 0;
+    for (j = 0; j < a->num; j++) {
+      memset(f, 0, sizeof(f));
+      mpc_analysis_first(a, a->nodes[j], f);
+      changed |= mpc_analysis_union(a->first + 32 * j, f);
+    }
+  } while (changed);
+}
+
+static void mpc_analysis_report(mpc_analysis_t *a, int x, const char *fmt, ...) {
+  va_list va;
+  mpc_parser_t *rule = a->rules[x];
+  printf("%s: ", rule ? rule->name : "<anonymous>");
+  va_start(va, fmt);
+  vprintf(fmt, va);
+  va_end(va);
+  printf("\n");
+  a->issues++;
+}
+
+static void mpc_analysis_print_char(char *buf, int c) {
+  if (c > 32 && c < 127) { sprintf(buf, "'%c'", c); }
+  else { sprintf(buf, "'\\x%02x'", c); }
+}
+
+/*
+** Returns whether `target` can be reached from
+** node `x` without consuming any input.
+*/
+
+static int mpc_analysis_left(mpc_analysis_t *a, int x, mpc_parser_t *target) {
+  
+  int j, m, y;
+  mpc_parser_t **xs;
+  mpc_parser_t *p = a->nodes[x];
+  
+  m = mpc_children(p, &xs);
+  for (j = 0; j < m; j++) {
+    y = mpc_analysis_find(a, xs[j]);
+    if (xs[j] == target) { return 1; }
+    if (!a->seen[y]) {
+      a->seen[y] = 1;
+      if (mpc_analysis_left(a, y, target)) { return 1; }
+    }
+    if (p->type == MPC_TYPE_AND && !a->nullable[y]) { break; }
+  }
+  
+  return 0;
+}
+
+static void mpc_analysis_check(mpc_analysis_t *a, int x) {
+  
+  int j, k, c, m, y, z;
+  char buf[16];
+  mpc_parser_t **xs;
+  mpc_parser_t *p = a->nodes[x];
+  unsigned char *f, *g;
+  
+  if (p->type == MPC_TYPE_UNDEFINED) {
+    mpc_analysis_report(a, x, "parser is undefined");
+  }
+  
+  if (p->retained && p->type != MPC_TYPE_UNDEFINED) {
+    memset(a->seen, 0, a->num);
+    if (mpc_analysis_left(a, x, p)) {
+      mpc_analysis_report(a, x, "rule is left recursive");
+    }
+  }
+  
+  if (p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1) {
+    if (a->nullable[mpc_analysis_find(a, p->data.repeat.x)]) {
+      mpc_analysis_report(a, x, "repetition of a parser which can match empty input");
+    }
+  }
+  
+  if (p->type != MPC_TYPE_OR) { return; }
+  
+  m = mpc_children(p, &xs);
+  
+  for (j = 0; j < m - 1; j++) {
+    if (a->nullable[mpc_analysis_find(a, xs[j])]) {
+      mpc_analysis_report(a, x,
+        "alternative %i of %i can match empty input and may hide the rest", j + 1, m);
+    }
+  }
+  
+  for (j = 0; j < m; j++) {
+    y = mpc_analysis_find(a, xs[j]);
+    f = a->first + 32 * y;
+    for (k = j + 1; k < m; k++) {
+      z = mpc_analysis_find(a, xs[k]);
+      g = a->first + 32 * z;
+      for (c = 1; c < 256; c++) {
+        if (mpc_analysis_has(f, (unsigned char)c) && mpc_analysis_has(g, (unsigned char)c)) { break; }
+      }
+      if (c < 256) {
+        mpc_analysis_print_char(buf, c);
+        mpc_analysis_report(a, x,
+          "alternatives %i and %i of %i can both start with %s", j + 1, k + 1, m, buf);
+      }
+    }
+  }
+}
+
+int mpc_analyse(mpc_parser_t *p) {
+  
+  int j;
+  mpc_analysis_t a;
+  
+  a.num = 0;
+  a.slots = 64;
+  a.nodes = malloc(sizeof(mpc_parser_t*) * a.slots);
+  a.rules = malloc(sizeof(mpc_parser_t*) * a.slots);
+  a.table_slots = 128;
+  a.table = calloc(a.table_slots, sizeof(int));
+  a.issues = 0;
+  
+  mpc_analysis_add(&a, p, NULL);
+  
+  a.nullable = calloc(a.num, 1);
+  a.first = calloc(a.num, 32);
+  a.seen = calloc(a.num, 1);
+  
+  mpc_analysis_solve(&a);
+  
+  printf("Analysis\n");
+  printf("========\n");
+  for (j = 0; j < a.num; j++) { mpc_analysis_check(&a, j); }
+  printf("Issues: %i\n", a.issues);
+  
+  free(a.nodes);
+  free(a.rules);
+  free(a.table);
+  free(a.nullable);
+  free(a.first);
+  free(a.seen);
+  
+  return a.issues;
 }
 
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
@@ -3725,7 +5621,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, t->data.or.xs + 1, n * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
       free(t->data.or.xs); free(t->name); free(t);
       continue;
@@ -21,6 +21,8 @@ extern "C" {
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
+#include <limits.h>
 
 /*
 ** State Type
@@ -32,6 +34,26 @@ typedef struct {
   long col;
 } mpc_state_t;
 
+/*
+** Output Buffer
+**
+** Printers append to a growable buffer which
+** the caller owns and can reuse between calls.
+** `mpc_buf_write` flushes it with a single
+** `fwrite` and leaves it empty for reuse.
+*/
+
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} mpc_buf_t;
+
+void mpc_buf_init(mpc_buf_t *b);
+void mpc_buf_free(mpc_buf_t *b);
+void mpc_buf_clear(mpc_buf_t *b);
+size_t mpc_buf_write(mpc_buf_t *b, FILE *f);
+
 /*
 ** Error Type
 */
@@ -49,6 +71,7 @@ void mpc_err_delete(mpc_err_t *e);
 char *mpc_err_string(mpc_err_t *e);
 void mpc_err_print(mpc_err_t *e);
 void mpc_err_print_to(mpc_err_t *e, FILE *f);
+void mpc_err_print_buf(mpc_err_t *e, mpc_buf_t *b);
 
 /*
 ** Parsing
@@ -70,6 +93,24 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Parse Context
+*/
+
+struct mpc_ctx_t;
+typedef struct mpc_ctx_t mpc_ctx_t;
+
+mpc_ctx_t *mpc_ctx_new(void);
+void mpc_ctx_delete(mpc_ctx_t *c);
+void mpc_ctx_reset(mpc_ctx_t *c);
+void mpc_ctx_trim(mpc_ctx_t *c);
+
+void mpc_ctx_limit(mpc_ctx_t *c, unsigned long steps, void(*d)(mpc_val_t*));
+unsigned long mpc_ctx_steps(mpc_ctx_t *c);
+
+int mpc_ctx_parse(mpc_ctx_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_ctx_nparse(mpc_ctx_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+
 /*
 ** Function Types
 */
@@ -81,6 +122,22 @@ typedef mpc_val_t*(*mpc_apply_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_apply_to_t)(mpc_val_t*,void*);
 typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
 
+/*
+** Error Recovery
+*/
+
+typedef struct {
+  int outputs_num;
+  mpc_val_t **outputs;
+  int errors_num;
+  mpc_err_t **errors;
+} mpc_recovery_t;
+
+int mpc_parse_recover(const char *filename, const char *string, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r);
+int mpc_nparse_recover(const char *filename, const char *string, size_t length, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r);
+int mpc_ctx_nparse_recover(mpc_ctx_t *x, const char *filename, const char *string, size_t length, mpc_parser_t *p, const char *o, const char *c, mpc_recovery_t *r);
+void mpc_recovery_clear(mpc_recovery_t *r, mpc_dtor_t d);
+
 /*
 ** Building a Parser
 */
@@ -178,6 +235,7 @@ mpc_parser_t *mpc_number(void);
 mpc_parser_t *mpc_real(void);
 mpc_parser_t *mpc_float(void);
 
+mpc_parser_t *mpc_int_lit(void);
 mpc_parser_t *mpc_char_lit(void);
 mpc_parser_t *mpc_string_lit(void);
 mpc_parser_t *mpc_regex_lit(void);
@@ -251,6 +309,26 @@ mpc_val_t *mpcf_trd_free(int n, mpc_val_t** xs);
 mpc_val_t *mpcf_strfold(int n, mpc_val_t** xs);
 mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 
+/*
+** UTF-8
+**
+** Returns the offset of the first byte which is
+** not part of a valid UTF-8 sequence, or -1.
+*/
+
+long mpc_utf8_check(const char *s, long n);
+
+/*
+** Number Scanning
+**
+** Reads an optional '-' and decimal digits from
+** the start of `s`, returning how many bytes it
+** used or zero if there was no number. Values out
+** of range set `overflow` and are clamped.
+*/
+
+long mpc_scan_long(const char *s, long n, long *x, int *overflow);
+
 /*
 ** Regular Expression Parsers
 */
@@ -281,6 +359,7 @@ mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
+void mpc_ast_print_buf(mpc_ast_t *a, mpc_buf_t *b, int compact);
 
 int mpc_ast_get_index(mpc_ast_t *ast, const char *tag);
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb);
@@ -306,10 +385,47 @@ mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav);
 
 void mpc_ast_traverse_free(mpc_ast_trav_t **trav);
 
+typedef struct {
+  mpc_ast_t *node;
+  int child;
+} mpc_ast_frame_t;
+
+typedef struct {
+  mpc_ast_trav_order_t order;
+  mpc_ast_frame_t *frames;
+  int frames_num;
+  int depth;
+  int overflow;
+} mpc_ast_iter_t;
+
+int mpc_ast_depth(mpc_ast_t *a);
+void mpc_ast_iter_init(mpc_ast_iter_t *it, mpc_ast_t *ast, mpc_ast_trav_order_t order,
+                       mpc_ast_frame_t *frames, int frames_num);
+mpc_ast_t *mpc_ast_iter_next(mpc_ast_iter_t *it);
+
+struct mpc_ast_index_t;
+typedef struct mpc_ast_index_t mpc_ast_index_t;
+
+mpc_ast_index_t *mpc_ast_index_new(mpc_ast_t *ast);
+void mpc_ast_index_delete(mpc_ast_index_t *x);
+int mpc_ast_index_get(mpc_ast_index_t *x, const char *tag);
+int mpc_ast_index_get_lb(mpc_ast_index_t *x, const char *tag, int lb);
+mpc_ast_t *mpc_ast_index_child(mpc_ast_index_t *x, const char *tag);
+mpc_ast_t *mpc_ast_index_child_lb(mpc_ast_index_t *x, const char *tag, int lb);
+
 /*
 ** Warning: This function currently doesn't test for equality of the `state` member!
 */
 int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b);
+unsigned long mpc_ast_hash(mpc_ast_t *a);
+
+struct mpc_ast_cons_t;
+typedef struct mpc_ast_cons_t mpc_ast_cons_t;
+
+mpc_ast_cons_t *mpc_ast_cons_new(void);
+void mpc_ast_cons_delete(mpc_ast_cons_t *c);
+int mpc_ast_cons_num(mpc_ast_cons_t *c);
+mpc_ast_t *mpc_ast_cons(mpc_ast_cons_t *c, mpc_ast_t *a);
 
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **as);
 mpc_val_t *mpcf_str_ast(mpc_val_t *c);
@@ -352,6 +468,13 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
+int mpc_analyse(mpc_parser_t *p);
+
+void mpc_profile_enable(mpc_parser_t *p);
+void mpc_profile_disable(mpc_parser_t *p);
+void mpc_profile_print(mpc_parser_t *p);
+void mpc_profile_print_to(mpc_parser_t *p, FILE *fp);
+void mpc_profile_print_json_to(mpc_parser_t *p, FILE *fp);
 
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*), 
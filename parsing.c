@@ -1,8 +1,37 @@
 /*---------------------------------------------------------------------
  * HEADERS
  *---------------------------------------------------------------------*/
+/* isatty and fileno are POSIX, which -std=c99 hides otherwise */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* Hot functions are compiled to native code on x86-64 System V
+ * targets, everywhere else the VM runs everything */
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(CLISP_NO_JIT)
+#define CLISP_JIT
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#define read _read
+#else
+#include <unistd.h>
+#endif
+#ifdef CLISP_JIT
+#include <sys/mman.h>
+#endif
 #include <editline/readline.h>  //TODO: #ifdef _WIN32 doesn't need readline.h to edit lines. Increase portability.
 
 #include "mpc.h"
@@ -15,389 +44,5005 @@ typedef int lval_type_field; enum
     LVAL_ERR,
     LVAL_NUM,
     LVAL_SEXPR,
-    LVAL_SYM
+    LVAL_SYM,
+    LVAL_FUN,
+    LVAL_LAMBDA,
+    LVAL_FREE,
+    LVAL_MOVED
+    };
+
+struct lval;
+struct proto;
+
+/* Builtins take their arguments as one list, which they consume */
+typedef struct lval* (*lbuiltin)
+    (
+    struct lval* args
+    );
+
+/* Builtins are bound to their names once, at startup, so applying one
+ * is a symbol lookup and a call through a pointer */
+typedef struct builtin
+    {
+    const char* name;
+    lbuiltin fun;
+    } builtin;
+
+/* Positions of the builtins in their table */
+typedef int builtin_id; enum
+    {
+    BUILTIN_ADD,
+    BUILTIN_SUB,
+    BUILTIN_MUL,
+    BUILTIN_DIV,
+    BUILTIN_MOD,
+    BUILTIN_LT,
+    BUILTIN_GT,
+    BUILTIN_LE,
+    BUILTIN_GE,
+    BUILTIN_EQ,
+    BUILTIN_NE,
+    BUILTIN_GC_STATS,
+    BUILTIN_COUNT
+    };
+
+/* Each distinct symbol name is stored once, so symbols compare by
+ * pointer. A symbol also holds its global binding, if it has one, and
+ * whether that was bound to a value in the nursery since the last
+ * collection. */
+typedef struct symbol
+    {
+    unsigned long hash;
+    size_t length;
+    struct lval* value;
+    int bound;
+    char name[];
+    } symbol;
+
+/* Open addressing table of every symbol read so far. Its capacity is
+ * a power of two and it is kept at most half full. */
+typedef struct
+    {
+    symbol** slots;
+    size_t capacity;
+    size_t count;
+    } symbol_table;
+
+enum { SYMBOL_TABLE_MIN = 64 };
+
+/* Whether a function has native code */
+typedef int jit_status; enum
+    {
+    JIT_PENDING,
+    JIT_READY,
+    JIT_UNSUPPORTED,
+    JIT_DISABLED
     };
 
+/* A function written in Lisp. It sees its own arguments and the
+ * globals, there are no closures. */
+typedef struct lambda
+    {
+    int arity;
+    struct lval* formals;
+    struct lval* body;
+    struct proto* code;
+    long calls;
+    int bails;
+    jit_status jit;
+    struct jit_code* native;
+    } lambda;
+
+/* The arguments of the function the tree walker is evaluating */
 typedef struct
     {
-    lval_type_field type;
-    char* err;
-    char* sym;
-    long num;
+    const lambda* fn;
+    struct lval** args;
+    } lframe;
+
+/* Calls nest at most this deep in every evaluator, which keeps the
+ * tree walker well inside the C stack */
+enum { CALL_DEPTH_MAX = 10000 };
+
+/* A value is a single word. Integers that fit in all but one bit of a
+ * pointer are stored in the word itself with the low bit set, so they
+ * are never allocated. Everything else points to one of these on the
+ * collected heap, which is 16 bytes on 64-bit targets. Values are
+ * never changed once built, so they are shared rather than copied.
+ * Use lval_type and lval_to_num rather than reading the fields of a
+ * value directly. */
+typedef struct lval
+    {
+    unsigned char type;
+    unsigned char marked;
+    unsigned char remembered;
     int cell_count;
-    struct lval** cell;
+    union
+        {
+        long num;
+        char* err;
+        symbol* sym;
+        const builtin* fun;
+        lambda* fn;
+        struct lval** cell;
+        struct lval* next; /* when free, or where it moved to */
+        } data;
     } lval;
 
+/* Range of the integers stored inline */
+#define LVAL_INT_MIN ( INTPTR_MIN / 2 )
+#define LVAL_INT_MAX ( INTPTR_MAX / 2 )
+
+/* Bytecode. Each op is a byte followed by its operands, which are
+ * 16-bit little-endian unless noted. */
+typedef int opcode; enum
+    {
+    OP_CONST,       /* k: push constant k                            */
+    OP_ERROR,       /* k: fail with constant k                       */
+    OP_NIL,         /* push ()                                       */
+    OP_LOCAL,       /* i, 8-bit: push argument i                     */
+    OP_GLOBAL,      /* k: push the binding of global k               */
+    OP_DEF,         /* k: bind global k to the top, leaving ()       */
+    OP_JUMP,        /* a: continue at a                              */
+    OP_JUMP_FALSE,  /* a: pop a number, continue at a if it is 0     */
+    OP_CALL,        /* n, 8-bit: apply the function below n values   */
+    OP_RETURN,      /* return the top                                */
+
+    /* k: apply a builtin to the top two values, inline while global k
+     * is still bound to it. These follow the order of the builtins. */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_EQ,
+    OP_NE
+    };
+
+/* Code compiled from a top-level form or a function body. Constants
+ * are pooled, globals are resolved to their symbols and arguments to
+ * slots on the stack. */
+typedef struct proto
+    {
+    unsigned char* code;
+    int code_length;
+    int code_capacity;
+    lval** constants;
+    int constants_num;
+    symbol** globals;
+    int globals_num;
+    int stack;
+    } proto;
+
+/* Compiles one proto. The arguments are those of fn, if any. */
+typedef struct
+    {
+    proto* p;
+    const lambda* fn;
+    int depth;
+    int failed;
+    } compiler;
+
+/* Where to continue when a called function returns. The base is an
+ * index, the stack may move as it grows. */
+typedef struct
+    {
+    const proto* p;
+    const unsigned char* ip;
+    size_t base;
+    } vm_frame;
+
+/* The operand stack and call frames, kept between forms. The
+ * collector scans the stack up to sp and the constants of the
+ * top-level code, the code of functions is reached through them. */
+typedef struct
+    {
+    lval** stack;
+    lval** sp;
+    size_t stack_capacity;
+    vm_frame* frames;
+    size_t frames_capacity;
+    const proto* top;
+    } vm;
+
+enum { VM_STACK_MIN = 1024 };
+
+/* Native code takes the arguments as longs and stores the result,
+ * returning 0 instead when the VM has to run the call */
+typedef int (*jit_entry)
+    (
+    const long* args,
+    long* result
+    );
+
+/* The native code of a function, which keeps the functions it calls
+ * directly alive */
+typedef struct jit_code
+    {
+    jit_entry entry;
+    void* memory;
+    size_t size;
+    lval** callees;
+    int callees_num;
+    } jit_code;
+
+/* Machine code being written. Jumps are patched once every op has an
+ * address, the bail out returns 0. */
+typedef struct
+    {
+    unsigned char* code;
+    int length;
+    int capacity;
+    int* fixups;
+    int* targets;
+    int fixups_num;
+    int* labels;
+    int bail;
+    } jit_emitter;
+
+typedef int jit_mode_field; enum
+    {
+    JIT_OFF,
+    JIT_ON,
+    JIT_VERIFY
+    };
+
+enum
+    {
+    JIT_THRESHOLD = 1000,
+    JIT_MAX_ARGS = 8,
+    JIT_MAX_BAILS = 16,
+    JIT_STACK_BYTES = 1 << 20
+    };
+
+/* Where the major collection of the old generation is */
+typedef int gc_phase; enum
+    {
+    GC_IDLE,
+    GC_MARKING,
+    GC_SWEEPING
+    };
+
+enum
+    {
+    GC_NURSERY = 32768,
+    GC_REGION = 1 << 20,        /* bytes */
+    GC_CHUNK = 4096,
+    GC_MIN_THRESHOLD = 65536,
+    GC_PAUSE_TARGET = 1000,     /* microseconds */
+    GC_PAUSE_BUCKETS = 24,
+    GC_STEP_CHECK = 256,
+    GC_PACE = 2
+    };
+
+/* A growable stack of values */
+typedef struct
+    {
+    lval** items;
+    size_t num;
+    size_t capacity;
+    } gc_stack;
+
+/* Values are bump allocated in the nursery, and the cell arrays and
+ * error text of those values in a region of bytes beside it. A minor
+ * collection moves the values still reachable into the old
+ * generation, copying what they own out of the region, then releases
+ * the nursery and region at once by resetting them. Its roots are the
+ * globals bound since the last one, the VM stack, the top-level code,
+ * the protected variables and the old values which were given a
+ * pointer into the nursery, so its cost grows with what escapes and
+ * not with what was made. The old generation is made of chunks whose
+ * free cells are chained through their data. The few young values
+ * which own memory outside the region, functions and lists made while
+ * it was full, are kept on a list and finalized when they die.
+ *
+ * Once the old generation has doubled it is collected incrementally,
+ * a step each time the nursery fills, each step stopping at the pause
+ * target. Each value moved to the old generation meanwhile adds to a
+ * debt of work, which a step pays before it stops, so the collection
+ * keeps up with the program however short the target. Marking is
+ * tri-color: values marked with the current epoch are gray while on
+ * the gray stack and black after, the rest white. Values are
+ * allocated black, a value stored into a black one is shaded, and the
+ * roots are marked again before marking finishes. Sweeping frees the
+ * white values a chunk at a time.
+ *
+ * Collections only run at safe points, when the VM calls a function
+ * and after each top-level form, so values held in C locals elsewhere
+ * are neither freed nor moved. */
+typedef struct
+    {
+    lval* nursery;
+    lval* nursery_top;
+    lval* nursery_end;
+    char* region;
+    char* region_top;
+    char* region_end;
+    symbol** bound;
+    size_t bound_num;
+    size_t bound_capacity;
+    gc_stack finalizable;
+    gc_stack remembered;
+    gc_stack copied;
+    lval** chunks;
+    int chunks_num;
+    lval* free;
+    size_t live;
+    size_t allocated;
+    size_t threshold;
+    int pending;
+    int major;
+    gc_phase phase;
+    unsigned char epoch;
+    int sweep_chunk;
+    long debt;
+    gc_stack gray;
+    lval*** roots;
+    int roots_num;
+    int roots_capacity;
+
+    /* Pauses, in clock ticks, and a histogram of them in powers of
+     * two microseconds */
+    clock_t pause_target;
+    clock_t pause_max;
+    clock_t pause_total;
+    size_t pauses[GC_PAUSE_BUCKETS];
+    size_t minors;
+    size_t majors;
+    } gc_heap;
+
+enum { SLAB_CLASSES = 11, SLAB_BLOCK = 65536 };
+
+/* Cell arrays hold a power of two elements. Those of up to 1024 are
+ * carved from shared blocks and kept on a free list per size when
+ * freed, larger ones are malloc'd. Blocks are kept until exit. */
+typedef struct
+    {
+    lval** free[SLAB_CLASSES];
+    size_t live[SLAB_CLASSES];
+    size_t large;
+    char* top;
+    char* end;
+    char** blocks;
+    int blocks_num;
+    } slab_heap;
+
+/* The parsers of the language, the last of which reads a whole
+ * program */
+typedef struct
+    {
+    mpc_parser_t* number;
+    mpc_parser_t* symbol;
+    mpc_parser_t* sexpression;
+    mpc_parser_t* expression;
+    mpc_parser_t* program;
+    } language;
+
+/* Accumulates REPL lines until the top-level forms they contain are
+ * complete. Only the newly fed characters are scanned for brackets. */
+typedef struct
+    {
+    char* text;
+    size_t length;
+    size_t capacity;
+    size_t complete;
+    int depth;
+    int unbalanced;
+    } reader;
+
+/* Most bytes read from a non-interactive stdin at a time */
+enum { STREAM_CHUNK = 65536 };
+
+/* Parsed top-level forms keyed by their text, so re-entering or
+ * re-sending an unchanged form does not parse it again */
+enum { FORM_CACHE_SLOTS = 256 };
+
+typedef struct
+    {
+    unsigned long hash;
+    size_t length;
+    char* text;
+    mpc_ast_t* ast;
+    } form_cache_entry;
+
+typedef struct
+    {
+    form_cache_entry slots[FORM_CACHE_SLOTS];
+    } form_cache;
+
 /*---------------------------------------------------------------------
  * FUNCTION DECLARATIONS
  *---------------------------------------------------------------------*/
+/* Language */
+void language_init
+    (
+    language* l
+    );
+
+void language_free
+    (
+    language* l
+    );
+
+/* Symbols */
+void symbol_table_init
+    (
+    symbol_table* t
+    );
+
+void symbol_table_free
+    (
+    symbol_table* t
+    );
+
+symbol* symbol_intern
+    (
+    symbol_table* t,
+    const char* name,
+    size_t length
+    );
+
+void symbol_table_grow
+    (
+    symbol_table* t
+    );
+
+unsigned long text_hash
+    (
+    const char* text,
+    size_t length
+    );
+
 /* Evaluators */
-lval evaluate
+lval* eval_form
     (
-    mpc_ast_t* t
+    lval* v
+    );
+
+void eval_print
+    (
+    lval* v
+    );
+
+lval* lval_eval
+    (
+    lframe* e,
+    lval* v
+    );
+
+lval* lval_eval_sexpr
+    (
+    lframe* e,
+    lval* v
+    );
+
+lval* lval_eval_sym
+    (
+    lframe* e,
+    lval* v
+    );
+
+lval* lval_eval_def
+    (
+    lframe* e,
+    lval* v
+    );
+
+lval* lval_eval_if
+    (
+    lframe* e,
+    lval* v
+    );
+
+lval* lval_eval_fn
+    (
+    lval* v
+    );
+
+lval* lval_call
+    (
+    lval* f,
+    lval* a
+    );
+
+
+/* Builtins */
+void builtins_init
+    (
+    void
+    );
+
+lval* builtin_add
+    (
+    lval* a
+    );
+
+lval* builtin_sub
+    (
+    lval* a
+    );
+
+lval* builtin_mul
+    (
+    lval* a
+    );
+
+lval* builtin_div
+    (
+    lval* a
+    );
+
+lval* builtin_mod
+    (
+    lval* a
+    );
+
+lval* builtin_lt
+    (
+    lval* a
+    );
+
+lval* builtin_gt
+    (
+    lval* a
+    );
+
+lval* builtin_le
+    (
+    lval* a
+    );
+
+lval* builtin_ge
+    (
+    lval* a
+    );
+
+lval* builtin_eq
+    (
+    lval* a
+    );
+
+lval* builtin_ne
+    (
+    lval* a
+    );
+
+lval* builtin_compare
+    (
+    lval* a,
+    builtin_id op
+    );
+
+lval* builtin_gc_stats
+    (
+    lval* a
+    );
+
+/* Compiler */
+proto* proto_new
+    (
+    void
+    );
+
+void proto_free
+    (
+    proto* p
+    );
+
+proto* compile_form
+    (
+    const lambda* fn,
+    lval* v
+    );
+
+void compile_expr
+    (
+    compiler* c,
+    lval* v
+    );
+
+void compile_sexpr
+    (
+    compiler* c,
+    lval* v
+    );
+
+void compile_error
+    (
+    compiler* c,
+    char* msg
+    );
+
+int compile_constant
+    (
+    compiler* c,
+    lval* x
+    );
+
+int compile_global
+    (
+    compiler* c,
+    symbol* s
+    );
+
+int compile_local
+    (
+    const lambda* fn,
+    symbol* s
+    );
+
+void compile_byte
+    (
+    compiler* c,
+    int b
+    );
+
+void compile_u16
+    (
+    compiler* c,
+    int x
+    );
+
+void compile_patch
+    (
+    compiler* c,
+    int at
+    );
+
+void compile_push
+    (
+    compiler* c,
+    int n
+    );
+
+/* Virtual Machine */
+void vm_init
+    (
+    vm* m
+    );
+
+void vm_free
+    (
+    vm* m
+    );
+
+void vm_reserve
+    (
+    vm* m,
+    size_t used,
+    size_t n
+    );
+
+lval* vm_eval
+    (
+    vm* m,
+    lval* v
+    );
+
+lval* vm_run
+    (
+    vm* m,
+    const proto* p
+    );
+
+/* JIT */
+#ifdef CLISP_JIT
+int jit_compile
+    (
+    lambda* fn
+    );
+
+void jit_free
+    (
+    jit_code* j
+    );
+
+int jit_call
+    (
+    lval* f,
+    lval** args,
+    int n,
+    size_t depth,
+    lval** result
     );
 
-lval evaluate_op
-    (
-    lval x,
-    lval y,
-    char* operator
-    );
+int jit_op_size
+    (
+    int op
+    );
+
+int jit_holds_callee
+    (
+    lval** callee,
+    int from,
+    int to
+    );
+
+void jit_bytes
+    (
+    jit_emitter* e,
+    int n,
+    ...
+    );
+
+void jit_u32
+    (
+    jit_emitter* e,
+    uint32_t x
+    );
+
+void jit_u64
+    (
+    jit_emitter* e,
+    uint64_t x
+    );
+
+void jit_slot
+    (
+    jit_emitter* e,
+    int op,
+    int modrm,
+    int slot
+    );
+
+void jit_jump
+    (
+    jit_emitter* e,
+    int cc,
+    int target
+    );
+
+void jit_fixup
+    (
+    jit_emitter* e,
+    int target
+    );
+
+void jit_epilogue
+    (
+    jit_emitter* e
+    );
+
+void jit_emitter_free
+    (
+    jit_emitter* e
+    );
+#endif
+
+/* Reading */
+lval* lval_read
+    (
+    mpc_ast_t* t
+    );
+
+lval* lval_read_num
+    (
+    mpc_ast_t* t
+    );
+
+lval* lval_add
+    (
+    lval* v,
+    lval* x
+    );
+
+lval* lval_join
+    (
+    lval* x,
+    lval* y
+    );
+
+/* Reader */
+void reader_init
+    (
+    reader* r
+    );
+
+void reader_free
+    (
+    reader* r
+    );
+
+void reader_clear
+    (
+    reader* r
+    );
+
+int reader_feed
+    (
+    reader* r,
+    const char* line
+    );
+
+void reader_append
+    (
+    reader* r,
+    const char* text,
+    size_t length
+    );
+
+void reader_consume
+    (
+    reader* r,
+    size_t length
+    );
+
+void reader_scan
+    (
+    reader* r,
+    size_t start
+    );
+
+/* Form Cache */
+void form_cache_init
+    (
+    form_cache* c
+    );
+
+void form_cache_free
+    (
+    form_cache* c
+    );
+
+mpc_ast_t* form_cache_parse
+    (
+    form_cache* c,
+    mpc_ctx_t* context,
+    mpc_parser_t* program,
+    const char* text,
+    size_t length
+    );
+
+lval* read_program
+    (
+    form_cache* c,
+    mpc_ctx_t* context,
+    mpc_parser_t* program,
+    reader* r,
+    mpc_err_t** error
+    );
+
+/* Loading */
+char* load_file
+    (
+    const char* filename,
+    size_t* length
+    );
+
+int load_program
+    (
+    const char* filename,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    );
+
+int load_stream
+    (
+    FILE* stream,
+    const char* filename,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    );
+
+int load_forms
+    (
+    const char* filename,
+    const char* text,
+    size_t length,
+    mpc_state_t start,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    );
+
+void load_error
+    (
+    mpc_err_t* error,
+    mpc_state_t start
+    );
+
+/* Constructors */
+lval* lval_num
+    (
+    long num
+    );
+
+lval* lval_err
+    (
+    char* msg
+    );
+
+lval* lval_sym
+    (
+    const char* name
+    );
+
+lval* lval_fun
+    (
+    const builtin* b
+    );
+
+lval* lval_sexpr
+    (
+    void
+    );
+
+lval* lval_lambda
+    (
+    lval* formals,
+    lval* body
+    );
+
+void lambda_free
+    (
+    lambda* fn
+    );
+
+/* Garbage Collection */
+void gc_init
+    (
+    void
+    );
+
+void gc_free
+    (
+    void
+    );
+
+lval* gc_alloc
+    (
+    void
+    );
+
+lval* gc_alloc_old
+    (
+    void
+    );
+
+int gc_is_young
+    (
+    const lval* v
+    );
+
+void* gc_region_alloc
+    (
+    size_t size
+    );
+
+int gc_in_region
+    (
+    const void* p
+    );
+
+lval** gc_cells
+    (
+    lval* owner,
+    int count
+    );
+
+void gc_release_cells
+    (
+    lval** cells,
+    int count
+    );
+
+void gc_bind
+    (
+    symbol* s,
+    lval* v
+    );
+
+void gc_barrier
+    (
+    lval* owner,
+    lval* v
+    );
+
+void gc_remember
+    (
+    lval* owner
+    );
+
+void gc_push
+    (
+    gc_stack* s,
+    lval* v
+    );
+
+void gc_collect
+    (
+    void
+    );
+
+void gc_step
+    (
+    clock_t deadline
+    );
+
+void gc_minor
+    (
+    void
+    );
+
+void gc_evacuate
+    (
+    lval** slot
+    );
+
+void gc_scan
+    (
+    lval* v
+    );
+
+void gc_mark_roots
+    (
+    void
+    );
+
+void gc_mark
+    (
+    lval* v
+    );
+
+void gc_mark_proto
+    (
+    const proto* p
+    );
+
+int gc_drain
+    (
+    clock_t deadline
+    );
+
+int gc_sweep
+    (
+    clock_t deadline
+    );
+
+void gc_finalize
+    (
+    lval* v
+    );
+
+void gc_record
+    (
+    clock_t pause
+    );
+
+void gc_print_stats
+    (
+    void
+    );
+
+void gc_protect
+    (
+    lval** v
+    );
+
+void gc_unprotect
+    (
+    void
+    );
+
+/* Cell Arrays */
+void slab_free
+    (
+    void
+    );
+
+int slab_class
+    (
+    int count
+    );
+
+lval** slab_alloc
+    (
+    int count
+    );
+
+void slab_release
+    (
+    lval** cells,
+    int count
+    );
+
+void slab_print_stats
+    (
+    void
+    );
+
+/* Values */
+int lval_is_int
+    (
+    const lval* v
+    );
+
+lval_type_field lval_type
+    (
+    const lval* v
+    );
+
+long lval_to_num
+    (
+    const lval* v
+    );
+
+/* Utility */
+void lval_expr_print
+    (
+    lval* v,
+    char open,
+    char close
+    );
+
+void lval_print
+    (
+    lval* v
+    );
+
+void lval_println
+    (
+    lval* v
+    );
+
+/*---------------------------------------------------------------------
+ * VARIABLES
+ *---------------------------------------------------------------------*/
+static const builtin builtins[] =
+    {
+    { "+", builtin_add },
+    { "-", builtin_sub },
+    { "*", builtin_mul },
+    { "/", builtin_div },
+    { "%", builtin_mod },
+    { "<", builtin_lt },
+    { ">", builtin_gt },
+    { "<=", builtin_le },
+    { ">=", builtin_ge },
+    { "==", builtin_eq },
+    { "!=", builtin_ne },
+    { "gc-stats", builtin_gc_stats }
+    };
+
+/* Every symbol, and through them the global environment */
+static symbol_table symbols;
+
+/* The symbols bound to each builtin at startup */
+static symbol* builtin_symbols[BUILTIN_COUNT];
+
+/* The special forms, which are recognised by their symbol */
+static symbol* sym_def;
+static symbol* sym_if;
+static symbol* sym_fn;
+
+/* Applied even on its own, as it takes no arguments */
+static symbol* sym_gc_stats;
+
+/* Forms are compiled and run on the VM unless the tree walker, which
+ * is kept as the reference, is asked for */
+static vm machine;
+static int tree_walk;
+
+/* How many calls to lambdas the tree walker is inside */
+static int call_depth;
+
+/* The collected heap, and how long a step of its major collections
+ * may take in microseconds */
+static gc_heap heap;
+static long gc_pause = GC_PAUSE_TARGET;
+
+/* The cell arrays of the values on the heap */
+static slab_heap slabs;
+
+#ifdef CLISP_JIT
+/* Native code is used unless turned off, and can be checked against
+ * the tree walker */
+static jit_mode_field jit_mode = JIT_ON;
+
+/* Native code bails out when the stack pointer is below this, or
+ * when it would nest more calls than are left */
+static uintptr_t jit_stack_limit;
+static long jit_calls_left;
+
+/* setcc for each comparison, in the order of the ops */
+static const unsigned char jit_setcc[] = { 0x9C, 0x9F, 0x9E, 0x9D, 0x94, 0x95 };
+#endif
+
+/* Returns an error from a builtin unless the condition holds */
+#define LASSERT(cond, msg) \
+    if( !( cond ) ) { return lval_err(msg); }
+
+/*---------------------------------------------------------------------
+ * FUNCTIONS
+ *---------------------------------------------------------------------*/
+/* Builds which bring their own main, such as the parser benchmark,
+ * define CLISP_NO_MAIN */
+#ifndef CLISP_NO_MAIN
+int main
+    (
+    int argc,
+    char** argv
+    )
+{
+/* --tree evaluates with the tree walker instead of the VM, --no-jit
+ * runs everything on the VM, --jit-verify checks the results of
+ * native code against the tree walker and --gc-pause=N sets the pause
+ * target of the collector in microseconds */
+int first = 1;
+for( ; first < argc && strncmp(argv[first], "--", 2) == 0; ++first )
+    {
+    if( strcmp(argv[first], "--tree") == 0 )            { tree_walk = 1; }
+    else if( strncmp(argv[first], "--gc-pause=", 11) == 0 ) { gc_pause = atol(argv[first] + 11); }
+#ifdef CLISP_JIT
+    else if( strcmp(argv[first], "--no-jit") == 0 )     { jit_mode = JIT_OFF; }
+    else if( strcmp(argv[first], "--jit-verify") == 0 ) { jit_mode = JIT_VERIFY; }
+#else
+    /* There is no native code to turn off or check on this target */
+    else if( strcmp(argv[first], "--no-jit") == 0 )     { }
+    else if( strcmp(argv[first], "--jit-verify") == 0 ) { }
+#endif
+    else
+        {
+        printf("Unknown option %s\n", argv[first]);
+        return 1;
+        }
+    }
+
+/* Create the language parsers */
+language lang;
+language_init(&lang);
+
+/* Create the heap and the symbol table, bind the builtins and create
+ * the VM */
+gc_init();
+symbol_table_init(&symbols);
+builtins_init();
+vm_init(&machine);
+
+/* Create a parse context which is reused by every REPL iteration and
+ * every file */
+mpc_ctx_t* context = mpc_ctx_new();
+
+/* Bound the time a single input, or a single form of a file or of
+ * piped input, can take to parse */
+mpc_ctx_limit(context, 10000000, (mpc_dtor_t)mpc_ast_delete);
+
+/* Lines are accumulated until their forms are complete, and forms
+ * already parsed are reused when they are entered again */
+reader input_reader;
+form_cache forms;
+reader_init(&input_reader);
+form_cache_init(&forms);
+
+/* Load the files given on the command line instead of starting the
+ * REPL. Bad forms are reported and the rest of each file still loads. */
+if( argc > first )
+    {
+    int status = 0;
+    for( int i = first; i < argc; ++i )
+        {
+        if( !load_program(argv[i], lang.expression, context) ) { status = 1; }
+        }
+
+    reader_free(&input_reader);
+    form_cache_free(&forms);
+    mpc_ctx_delete(context);
+    language_free(&lang);
+    symbol_table_free(&symbols);
+    vm_free(&machine);
+    gc_free();
+    return status;
+    }
+
+/* Evaluate piped input in bulk, a form at a time as it arrives, rather
+ * than line by line through readline and its history */
+if( !isatty(fileno(stdin)) )
+    {
+    int status = load_stream(stdin, "<stdin>", lang.expression, context) ? 0 : 1;
+
+    reader_free(&input_reader);
+    form_cache_free(&forms);
+    mpc_ctx_delete(context);
+    language_free(&lang);
+    symbol_table_free(&symbols);
+    vm_free(&machine);
+    gc_free();
+    return status;
+    }
+
+/* Print out system information */
+puts("C Lisp Version 0.0.0");
+puts("Press Ctrl+C to Exit\n");
+
+while(1)
+    {
+    /* This REPL loop takes a user input and parses it */
+    char* input;
+    lval* x;
+    mpc_err_t* error;
+
+    /* Read the user input, continuing an unfinished form if any */
+    input = readline(input_reader.length == 0 ? "C-Lisp> " : "   ...> ");
+
+    /* End of input */
+    if( input == NULL )
+        {
+        putchar('\n');
+        break;
+        }
+
+    /* Allow the user to press up to retrieve command */
+    add_history(input);
+
+    /* Keep reading lines while brackets are left open */
+    if( !reader_feed(&input_reader, input) )
+        {
+        free(input);
+        continue;
+        }
+
+    /* Parse the user input */
+    x = read_program(&forms, context, lang.program, &input_reader, &error);
+    if( x )
+        {
+        /* Success: Evaluate the line as one expression and print it */
+        eval_print(x);
+        }
+    else
+        {
+        /* Failure: Print the error */
+        mpc_err_print(error);
+        mpc_err_delete(error);
+        }
+
+    /* Start a new form and free the pointer allocated by readline */
+    reader_clear(&input_reader);
+    free(input);
+    }
+
+/* Free the reader, the form cache, the parse context, the parsers,
+ * the symbols, the VM and the heap */
+reader_free(&input_reader);
+form_cache_free(&forms);
+mpc_ctx_delete(context);
+language_free(&lang);
+symbol_table_free(&symbols);
+vm_free(&machine);
+gc_free();
+return 0;
+}
+#endif
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void language_init
+    (
+    language* l
+    )
+{
+/* Create the language parsers */
+l->number      = mpc_new("number");
+l->symbol      = mpc_new("symbol");
+l->sexpression = mpc_new("sexpression");
+l->expression  = mpc_new("expression");
+l->program     = mpc_new("program");
+
+/* Numbers are scanned straight from the input in one step rather than
+ * a character at a time through the regex /-?[0-9]+/ */
+mpc_define(l->number, mpca_state(mpca_tag(
+    mpc_apply(mpc_tok(mpc_int_lit()), mpcf_str_ast), "number")));
+
+/* Define the language rules. Symbols may also hold any character
+ * beyond ASCII, written in the range as UTF-8 from U+0080 to U+10FFFF
+ * without the surrogates, so errors name the rule instead of listing
+ * the range. */
+mpca_lang(MPCA_LANG_DEFAULT,
+    "                                                                                                         \
+    symbol \"symbol\" : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%\xC2\x80-\xED\x9F\xBF\xEE\x80\x80-\xF4\x8F\xBF\xBF]+/ ; \
+    sexpression : '(' <expression>* ')' ;                                                                     \
+    expression  : <number> | <symbol> | <sexpression> ;                                                       \
+    program     : /^/ <expression>* /$/ ;                                                                     \
+    ",
+    l->number, l->symbol, l->sexpression, l->expression, l->program);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void language_free
+    (
+    language* l
+    )
+{
+mpc_cleanup(5, l->number, l->symbol, l->sexpression, l->expression, l->program);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void symbol_table_init
+    (
+    symbol_table* t
+    )
+{
+t->capacity = SYMBOL_TABLE_MIN;
+t->count = 0;
+t->slots = calloc(t->capacity, sizeof(symbol*));
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void symbol_table_free
+    (
+    symbol_table* t
+    )
+{
+/* Global bindings are freed with the heap */
+for( size_t i = 0; i < t->capacity; ++i )
+    {
+    free(t->slots[i]);
+    }
+
+free(t->slots);
+t->slots = NULL;
+t->capacity = 0;
+t->count = 0;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+symbol* symbol_intern
+    (
+    symbol_table* t,
+    const char* name,
+    size_t length
+    )
+{
+unsigned long hash = text_hash(name, length);
+size_t mask = t->capacity - 1;
+size_t i;
+symbol* s;
+
+/* Probe linearly from the hash, names are only compared when the
+ * stored hashes match */
+for( i = hash & mask; t->slots[i] != NULL; i = ( i + 1 ) & mask )
+    {
+    s = t->slots[i];
+    if( s->hash == hash
+     && s->length == length
+     && memcmp(s->name, name, length) == 0 )
+        {
+        return s;
+        }
+    }
+
+/* The name and the symbol share one allocation */
+s = malloc(sizeof(symbol) + length + 1);
+s->hash = hash;
+s->length = length;
+s->value = NULL;
+s->bound = 0;
+memcpy(s->name, name, length);
+s->name[length] = '\0';
+
+t->slots[i] = s;
+t->count++;
+if( t->count * 2 > t->capacity ) { symbol_table_grow(t); }
+
+return s;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void symbol_table_grow
+    (
+    symbol_table* t
+    )
+{
+symbol** old = t->slots;
+size_t old_capacity = t->capacity;
+size_t mask;
+
+/* Rehash into a table twice the size using the stored hashes */
+t->capacity *= 2;
+t->slots = calloc(t->capacity, sizeof(symbol*));
+mask = t->capacity - 1;
+
+for( size_t i = 0; i < old_capacity; ++i )
+    {
+    size_t j;
+
+    if( old[i] == NULL ) { continue; }
+    for( j = old[i]->hash & mask; t->slots[j] != NULL; j = ( j + 1 ) & mask ) {}
+    t->slots[j] = old[i];
+    }
+
+free(old);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+unsigned long text_hash
+    (
+    const char* text,
+    size_t length
+    )
+{
+/* FNV-1a */
+unsigned long hash = 2166136261UL;
+
+for( size_t i = 0; i < length; ++i )
+    {
+    hash = ( hash ^ (unsigned char)text[i] ) * 16777619UL;
+    }
+
+return hash;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* eval_form
+    (
+    lval* v
+    )
+{
+/* Before a form is a safe point for the collector */
+lval* result;
+
+gc_protect(&v);
+if( heap.pending ) { gc_collect(); }
+
+result = tree_walk ? lval_eval(NULL, v) : vm_eval(&machine, v);
+
+gc_unprotect();
+return result;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void eval_print
+    (
+    lval* v
+    )
+{
+/* What the form made and did not bind to a global is released with
+ * the nursery once it is printed */
+lval_println(eval_form(v));
+gc_collect();
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval
+    (
+    lframe* e,
+    lval* v
+    )
+{
+/* Symbols and S-expressions need evaluating, everything else is a
+ * value */
+if( lval_type(v) == LVAL_SYM )   { return lval_eval_sym(e, v); }
+if( lval_type(v) == LVAL_SEXPR ) { return lval_eval_sexpr(e, v); }
+return v;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval_sexpr
+    (
+    lframe* e,
+    lval* v
+    )
+{
+symbol* s = NULL;
+lval* f;
+lval* a;
+
+/* Special forms are recognised by their symbol before anything is
+ * evaluated */
+if( v->cell_count > 0 && lval_type(v->data.cell[0]) == LVAL_SYM )
+    {
+    s = v->data.cell[0]->data.sym;
+    if( s == sym_def ) { return lval_eval_def(e, v); }
+    if( s == sym_if )  { return lval_eval_if(e, v); }
+    if( s == sym_fn )  { return lval_eval_fn(v); }
+    }
+
+/* Empty expressions evaluate to themselves */
+if( v->cell_count == 0 ) { return v; }
+
+/* Evaluate the children in order, the first error is the result. A
+ * single expression evaluates to its child, unless it is gc-stats. */
+f = lval_eval(e, v->data.cell[0]);
+if( lval_type(f) == LVAL_ERR || ( v->cell_count == 1 && s != sym_gc_stats ) ) { return f; }
+
+a = lval_sexpr();
+for( int i = 1; i < v->cell_count; ++i )
+    {
+    lval* x = lval_eval(e, v->data.cell[i]);
+    if( lval_type(x) == LVAL_ERR ) { return x; }
+    a = lval_add(a, x);
+    }
+
+/* Apply the function to the rest of the list */
+return lval_call(f, a);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval_sym
+    (
+    lframe* e,
+    lval* v
+    )
+{
+/* Arguments shadow globals, which are held by the symbol itself */
+symbol* s = v->data.sym;
+
+if( e )
+    {
+    for( int i = 0; i < e->fn->arity; ++i )
+        {
+        if( e->fn->formals->data.cell[i]->data.sym == s ) { return e->args[i]; }
+        }
+    }
+
+if( s->value == NULL ) { return lval_err("Unbound symbol!"); }
+return s->value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval_def
+    (
+    lframe* e,
+    lval* v
+    )
+{
+/* (def name value) binds the value of an expression to a name, which
+ * is not itself evaluated */
+lval* x;
+
+LASSERT(v->cell_count == 3 && lval_type(v->data.cell[1]) == LVAL_SYM,
+    "def expects a symbol and a value!");
+
+x = lval_eval(e, v->data.cell[2]);
+if( lval_type(x) == LVAL_ERR ) { return x; }
+
+gc_bind(v->data.cell[1]->data.sym, x);
+return lval_sexpr();
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval_if
+    (
+    lframe* e,
+    lval* v
+    )
+{
+/* (if condition then else) evaluates one branch, any number other
+ * than 0 is true */
+lval* c;
+
+LASSERT(v->cell_count == 4, "if expects a condition and two branches!");
+
+c = lval_eval(e, v->data.cell[1]);
+if( lval_type(c) == LVAL_ERR ) { return c; }
+LASSERT(lval_type(c) == LVAL_NUM, "if expects a number condition!");
+
+return lval_eval(e, v->data.cell[lval_to_num(c) != 0 ? 2 : 3]);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_eval_fn
+    (
+    lval* v
+    )
+{
+/* (fn (arguments...) body) makes a function, nothing is evaluated */
+LASSERT(v->cell_count == 3 && lval_type(v->data.cell[1]) == LVAL_SEXPR,
+    "fn expects a list of symbols and a body!");
+for( int i = 0; i < v->data.cell[1]->cell_count; ++i )
+    {
+    LASSERT(lval_type(v->data.cell[1]->data.cell[i]) == LVAL_SYM,
+        "fn expects a list of symbols and a body!");
+    }
+
+return lval_lambda(v->data.cell[1], v->data.cell[2]);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_call
+    (
+    lval* f,
+    lval* a
+    )
+{
+lframe frame;
+lval* x;
+
+switch( lval_type(f) )
+    {
+    case LVAL_FUN:
+        return f->data.fun->fun(a);
+
+    /* Evaluate the body with the arguments in a frame, failing as the
+     * VM does before the C stack runs out */
+    case LVAL_LAMBDA:
+        if( a->cell_count != f->data.fn->arity ) { return lval_err("Incorrect number of arguments!"); }
+        if( call_depth == CALL_DEPTH_MAX ) { return lval_err("Too many nested calls!"); }
+        frame.fn = f->data.fn;
+        frame.args = a->data.cell;
+        call_depth++;
+        x = lval_eval(&frame, f->data.fn->body);
+        call_depth--;
+        return x;
+
+    default:
+        return lval_err("S-expression does not start with a function!");
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void builtins_init
+    (
+    void
+    )
+{
+/* Bind each operator globally, so applying one is a symbol lookup
+ * and a call through a pointer */
+for( int i = 0; i < BUILTIN_COUNT; ++i )
+    {
+    symbol* s = symbol_intern(&symbols, builtins[i].name, strlen(builtins[i].name));
+    gc_bind(s, lval_fun(&builtins[i]));
+    builtin_symbols[i] = s;
+    }
+
+sym_def = symbol_intern(&symbols, "def", 3);
+sym_if = symbol_intern(&symbols, "if", 2);
+sym_fn = symbol_intern(&symbols, "fn", 2);
+sym_gc_stats = builtin_symbols[BUILTIN_GC_STATS];
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_add
+    (
+    lval* a
+    )
+{
+long sum = 0;
+
+for( int i = 0; i < a->cell_count; ++i )
+    {
+    long x;
+
+    LASSERT(lval_type(a->data.cell[i]) == LVAL_NUM, "Cannot operate on non-number!");
+    x = lval_to_num(a->data.cell[i]);
+    LASSERT(( x <= 0 || sum <= LONG_MAX - x ) && ( x >= 0 || sum >= LONG_MIN - x ),
+        "Integer overflow!");
+    sum += x;
+    }
+
+return lval_num(sum);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_sub
+    (
+    lval* a
+    )
+{
+long result;
+
+for( int i = 0; i < a->cell_count; ++i )
+    {
+    LASSERT(lval_type(a->data.cell[i]) == LVAL_NUM, "Cannot operate on non-number!");
+    }
+
+/* A single argument is negated */
+result = lval_to_num(a->data.cell[0]);
+if( a->cell_count == 1 )
+    {
+    LASSERT(result != LONG_MIN, "Integer overflow!");
+    result = -result;
+    }
+
+for( int i = 1; i < a->cell_count; ++i )
+    {
+    long x = lval_to_num(a->data.cell[i]);
+
+    LASSERT(( x <= 0 || result >= LONG_MIN + x ) && ( x >= 0 || result <= LONG_MAX + x ),
+        "Integer overflow!");
+    result -= x;
+    }
+
+return lval_num(result);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_mul
+    (
+    lval* a
+    )
+{
+long product = 1;
+
+for( int i = 0; i < a->cell_count; ++i )
+    {
+    long x;
+
+    LASSERT(lval_type(a->data.cell[i]) == LVAL_NUM, "Cannot operate on non-number!");
+    x = lval_to_num(a->data.cell[i]);
+
+    /* Compare against the limits divided by one factor instead of
+     * multiplying first */
+    if( product != 0 && x != 0 )
+        {
+        if( product > 0 )
+            {
+            LASSERT(x > 0 ? product <= LONG_MAX / x : x >= LONG_MIN / product,
+                "Integer overflow!");
+            }
+        else
+            {
+            LASSERT(x > 0 ? product >= LONG_MIN / x : product >= LONG_MAX / x,
+                "Integer overflow!");
+            }
+        }
+    product *= x;
+    }
+
+return lval_num(product);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_div
+    (
+    lval* a
+    )
+{
+long result;
+
+for( int i = 0; i < a->cell_count; ++i )
+    {
+    LASSERT(lval_type(a->data.cell[i]) == LVAL_NUM, "Cannot operate on non-number!");
+    }
+
+result = lval_to_num(a->data.cell[0]);
+for( int i = 1; i < a->cell_count; ++i )
+    {
+    long x = lval_to_num(a->data.cell[i]);
+
+    LASSERT(x != 0, "Division By Zero!");
+    LASSERT(result != LONG_MIN || x != -1, "Integer overflow!");
+    result /= x;
+    }
+
+return lval_num(result);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_mod
+    (
+    lval* a
+    )
+{
+long result;
+
+for( int i = 0; i < a->cell_count; ++i )
+    {
+    LASSERT(lval_type(a->data.cell[i]) == LVAL_NUM, "Cannot operate on non-number!");
+    }
+
+result = lval_to_num(a->data.cell[0]);
+for( int i = 1; i < a->cell_count; ++i )
+    {
+    long x = lval_to_num(a->data.cell[i]);
+
+    LASSERT(x != 0, "Division By Zero!");
+
+    /* LONG_MIN % -1 overflows in C even though the answer is 0 */
+    result = x == -1 ? 0 : result % x;
+    }
+
+return lval_num(result);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_lt
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_LT);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_gt
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_GT);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_le
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_LE);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_ge
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_GE);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_eq
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_EQ);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_ne
+    (
+    lval* a
+    )
+{
+return builtin_compare(a, BUILTIN_NE);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_compare
+    (
+    lval* a,
+    builtin_id op
+    )
+{
+/* Comparisons are 1 when they hold and 0 otherwise */
+long x;
+long y;
+int result = 0;
+
+LASSERT(a->cell_count == 2, "Comparison expects two numbers!");
+LASSERT(lval_type(a->data.cell[0]) == LVAL_NUM && lval_type(a->data.cell[1]) == LVAL_NUM,
+    "Cannot operate on non-number!");
+
+x = lval_to_num(a->data.cell[0]);
+y = lval_to_num(a->data.cell[1]);
+switch( op )
+    {
+    case BUILTIN_LT: result = x <  y; break;
+    case BUILTIN_GT: result = x >  y; break;
+    case BUILTIN_LE: result = x <= y; break;
+    case BUILTIN_GE: result = x >= y; break;
+    case BUILTIN_EQ: result = x == y; break;
+    case BUILTIN_NE: result = x != y; break;
+    default:         break;
+    }
+
+return lval_num(result);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* builtin_gc_stats
+    (
+    lval* a
+    )
+{
+LASSERT(a->cell_count == 0, "gc-stats takes no arguments!");
+
+gc_print_stats();
+slab_print_stats();
+return lval_sexpr();
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+proto* proto_new
+    (
+    void
+    )
+{
+return calloc(1, sizeof(proto));
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void proto_free
+    (
+    proto* p
+    )
+{
+/* The constants are on the heap */
+free(p->constants);
+free(p->globals);
+free(p->code);
+free(p);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+proto* compile_form
+    (
+    const lambda* fn,
+    lval* v
+    )
+{
+compiler c;
+
+c.p = proto_new();
+c.fn = fn;
+c.depth = 0;
+c.failed = 0;
+
+compile_expr(&c, v);
+compile_byte(&c, OP_RETURN);
+
+/* Operands are at most 16 bits, anything which needs more raises an
+ * error instead */
+if( c.failed )
+    {
+    proto_free(c.p);
+    c.p = proto_new();
+    c.depth = 0;
+    c.failed = 0;
+    compile_error(&c, "Expression too large to compile!");
+    compile_byte(&c, OP_RETURN);
+    }
+
+/* Leave room for the function pushed under the operands when a
+ * builtin op falls back to a call */
+c.p->stack++;
+return c.p;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_expr
+    (
+    compiler* c,
+    lval* v
+    )
+{
+int i;
+
+switch( lval_type(v) )
+    {
+    /* Arguments are slots in the frame, anything else is global */
+    case LVAL_SYM:
+        i = compile_local(c->fn, v->data.sym);
+        if( i >= 0 )
+            {
+            if( i > 0xFF ) { c->failed = 1; }
+            compile_byte(c, OP_LOCAL);
+            compile_byte(c, i);
+            }
+        else
+            {
+            compile_byte(c, OP_GLOBAL);
+            compile_u16(c, compile_global(c, v->data.sym));
+            }
+        compile_push(c, 1);
+        break;
+
+    case LVAL_SEXPR:
+        compile_sexpr(c, v);
+        break;
+
+    /* Numbers which did not read fail when they are reached */
+    case LVAL_ERR:
+        compile_error(c, v->data.err);
+        break;
+
+    default:
+        compile_byte(c, OP_CONST);
+        compile_u16(c, compile_constant(c, v));
+        compile_push(c, 1);
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_sexpr
+    (
+    compiler* c,
+    lval* v
+    )
+{
+symbol* s = NULL;
+lval* x;
+int at_else;
+int at_end;
+
+if( v->cell_count == 0 )
+    {
+    compile_byte(c, OP_NIL);
+    compile_push(c, 1);
+    return;
+    }
+
+/* Special forms, malformed ones fail when they are reached as they
+ * do in the tree walker */
+if( lval_type(v->data.cell[0]) == LVAL_SYM ) { s = v->data.cell[0]->data.sym; }
+
+if( s == sym_def )
+    {
+    if( v->cell_count != 3 || lval_type(v->data.cell[1]) != LVAL_SYM )
+        {
+        compile_error(c, "def expects a symbol and a value!");
+        return;
+        }
+    compile_expr(c, v->data.cell[2]);
+    compile_byte(c, OP_DEF);
+    compile_u16(c, compile_global(c, v->data.cell[1]->data.sym));
+    return;
+    }
+
+if( s == sym_if )
+    {
+    if( v->cell_count != 4 )
+        {
+        compile_error(c, "if expects a condition and two branches!");
+        return;
+        }
+    compile_expr(c, v->data.cell[1]);
+    compile_byte(c, OP_JUMP_FALSE);
+    at_else = c->p->code_length;
+    compile_u16(c, 0);
+    compile_push(c, -1);
+
+    /* Each branch leaves one value */
+    compile_expr(c, v->data.cell[2]);
+    compile_push(c, -1);
+    compile_byte(c, OP_JUMP);
+    at_end = c->p->code_length;
+    compile_u16(c, 0);
+
+    compile_patch(c, at_else);
+    compile_expr(c, v->data.cell[3]);
+    compile_patch(c, at_end);
+    return;
+    }
+
+if( s == sym_fn )
+    {
+    /* The tree walker checks the form and makes the function, which
+     * is then a constant */
+    x = lval_eval_fn(v);
+    if( lval_type(x) == LVAL_ERR )
+        {
+        compile_error(c, x->data.err);
+        return;
+        }
+    compile_byte(c, OP_CONST);
+    compile_u16(c, compile_constant(c, x));
+    compile_push(c, 1);
+    return;
+    }
+
+if( v->cell_count == 1 && s != sym_gc_stats )
+    {
+    compile_expr(c, v->data.cell[0]);
+    return;
+    }
+
+/* Arithmetic and comparisons applied to two values get their own op,
+ * guarded by the binding of the symbol at run time */
+if( s && v->cell_count == 3 && compile_local(c->fn, s) < 0 )
+    {
+    for( int i = 0; i <= BUILTIN_NE; ++i )
+        {
+        if( builtin_symbols[i] != s ) { continue; }
+        compile_expr(c, v->data.cell[1]);
+        compile_expr(c, v->data.cell[2]);
+        compile_byte(c, OP_ADD + i);
+        compile_u16(c, compile_global(c, s));
+        compile_push(c, -1);
+        return;
+        }
+    }
+
+/* Otherwise push the function and its arguments and call it */
+if( v->cell_count - 1 > 0xFF ) { c->failed = 1; }
+for( int i = 0; i < v->cell_count; ++i )
+    {
+    compile_expr(c, v->data.cell[i]);
+    }
+compile_byte(c, OP_CALL);
+compile_byte(c, v->cell_count - 1);
+compile_push(c, 1 - v->cell_count);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_error
+    (
+    compiler* c,
+    char* msg
+    )
+{
+/* Counts as a value so the depth stays balanced */
+compile_byte(c, OP_ERROR);
+compile_u16(c, compile_constant(c, lval_err(msg)));
+compile_push(c, 1);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int compile_constant
+    (
+    compiler* c,
+    lval* x
+    )
+{
+proto* p = c->p;
+
+/* Equal inline integers share one slot */
+if( lval_is_int(x) )
+    {
+    for( int i = 0; i < p->constants_num; ++i )
+        {
+        if( p->constants[i] == x ) { return i; }
+        }
+    }
+
+p->constants = realloc(p->constants, sizeof(lval*) * ( p->constants_num + 1 ));
+p->constants[p->constants_num] = x;
+return p->constants_num++;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int compile_global
+    (
+    compiler* c,
+    symbol* s
+    )
+{
+proto* p = c->p;
+
+for( int i = 0; i < p->globals_num; ++i )
+    {
+    if( p->globals[i] == s ) { return i; }
+    }
+
+p->globals = realloc(p->globals, sizeof(symbol*) * ( p->globals_num + 1 ));
+p->globals[p->globals_num] = s;
+return p->globals_num++;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int compile_local
+    (
+    const lambda* fn,
+    symbol* s
+    )
+{
+/* The first argument of a name wins, as in the tree walker */
+if( fn == NULL ) { return -1; }
+for( int i = 0; i < fn->arity; ++i )
+    {
+    if( fn->formals->data.cell[i]->data.sym == s ) { return i; }
+    }
+
+return -1;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_byte
+    (
+    compiler* c,
+    int b
+    )
+{
+proto* p = c->p;
+
+if( p->code_length == p->code_capacity )
+    {
+    p->code_capacity = p->code_capacity ? p->code_capacity * 2 : 64;
+    p->code = realloc(p->code, p->code_capacity);
+    }
+
+p->code[p->code_length++] = (unsigned char)b;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_u16
+    (
+    compiler* c,
+    int x
+    )
+{
+if( x > 0xFFFF ) { c->failed = 1; }
+compile_byte(c, x & 0xFF);
+compile_byte(c, ( x >> 8 ) & 0xFF);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_patch
+    (
+    compiler* c,
+    int at
+    )
+{
+/* Point the jump operand at the next op */
+int x = c->p->code_length;
+
+if( x > 0xFFFF ) { c->failed = 1; }
+c->p->code[at] = x & 0xFF;
+c->p->code[at + 1] = ( x >> 8 ) & 0xFF;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void compile_push
+    (
+    compiler* c,
+    int n
+    )
+{
+c->depth += n;
+if( c->depth > c->p->stack ) { c->p->stack = c->depth; }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void vm_init
+    (
+    vm* m
+    )
+{
+m->stack_capacity = VM_STACK_MIN;
+m->stack = malloc(sizeof(lval*) * m->stack_capacity);
+m->frames_capacity = 64;
+m->frames = malloc(sizeof(vm_frame) * m->frames_capacity);
+m->sp = m->stack;
+m->top = NULL;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void vm_free
+    (
+    vm* m
+    )
+{
+free(m->stack);
+free(m->frames);
+m->stack = NULL;
+m->frames = NULL;
+m->stack_capacity = 0;
+m->frames_capacity = 0;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void vm_reserve
+    (
+    vm* m,
+    size_t used,
+    size_t n
+    )
+{
+/* Grow the stack so n more values fit above the used ones */
+if( used + n <= m->stack_capacity ) { return; }
+
+while( used + n > m->stack_capacity ) { m->stack_capacity *= 2; }
+m->stack = realloc(m->stack, sizeof(lval*) * m->stack_capacity);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* vm_eval
+    (
+    vm* m,
+    lval* v
+    )
+{
+/* Top-level forms run once, their code is not kept. Its constants
+ * are roots while it runs. */
+proto* p = compile_form(NULL, v);
+lval* result;
+
+m->top = p;
+result = vm_run(m, p);
+m->top = NULL;
+proto_free(p);
+
+return result;
+}
+
+/* Dispatch with one indirect jump per op where the compiler supports
+ * labels as values, otherwise with a switch */
+#if defined(__GNUC__) && !defined(CLISP_NO_THREADED)
+#define CLISP_THREADED
+#endif
+
+#ifdef CLISP_THREADED
+#define VM_DISPATCH() goto *dispatch[*ip++]
+#define VM_OP(o) op_##o
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_OP(o) case OP_##o
+#endif
+
+#define VM_U16(ip) ( (ip)[0] | ( (ip)[1] << 8 ) )
+
+/* Whether a global is still bound to the builtin its op applies */
+#define VM_BUILTIN(s, id) \
+    ( (s)->value && lval_type((s)->value) == LVAL_FUN && (s)->value->data.fun == &builtins[id] )
+
+/* Inline integers take at most half the range of a long when a long is
+ * as wide as a pointer, so they add and subtract without overflow, and
+ * those below this multiply without it */
+#if INTPTR_MAX <= LONG_MAX
+#define VM_FAST_ADD 1
+#else
+#define VM_FAST_ADD 0
+#endif
+#define VM_MUL_LIMIT ( LONG_MAX >> ( sizeof(long) * 4 ) )
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* vm_run
+    (
+    vm* m,
+    const proto* p
+    )
+{
+#ifdef CLISP_THREADED
+static const void* dispatch[] =
+    {
+    &&op_CONST, &&op_ERROR, &&op_NIL, &&op_LOCAL, &&op_GLOBAL,
+    &&op_DEF, &&op_JUMP, &&op_JUMP_FALSE, &&op_CALL, &&op_RETURN,
+    &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV, &&op_MOD,
+    &&op_LT, &&op_GT, &&op_LE, &&op_GE, &&op_EQ, &&op_NE
+    };
+#endif
+const unsigned char* ip = p->code;
+size_t depth = 0;
+lval** base;
+lval** sp;
+lval* result;
+lval* x;
+lval* f;
+symbol* s;
+long a;
+long b;
+int n;
+
+/* The form starts on an empty stack, called functions find their
+ * arguments where the caller pushed them */
+vm_reserve(m, 0, p->stack);
+base = m->stack;
+sp = base;
+
+VM_DISPATCH();
+#ifndef CLISP_THREADED
+dispatch:
+switch( *ip++ )
+#endif
+    {
+    VM_OP(CONST):
+        *sp++ = p->constants[VM_U16(ip)];
+        ip += 2;
+        VM_DISPATCH();
+
+    VM_OP(ERROR):
+        result = p->constants[VM_U16(ip)];
+        goto error;
+
+    VM_OP(NIL):
+        *sp++ = lval_sexpr();
+        VM_DISPATCH();
+
+    VM_OP(LOCAL):
+        *sp++ = base[*ip++];
+        VM_DISPATCH();
+
+    VM_OP(GLOBAL):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( s->value == NULL )
+            {
+            result = lval_err("Unbound symbol!");
+            goto error;
+            }
+        *sp++ = s->value;
+        VM_DISPATCH();
+
+    VM_OP(DEF):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        gc_bind(s, sp[-1]);
+        sp[-1] = lval_sexpr();
+        VM_DISPATCH();
+
+    VM_OP(JUMP):
+        ip = p->code + VM_U16(ip);
+        VM_DISPATCH();
+
+    VM_OP(JUMP_FALSE):
+        x = *--sp;
+        if( lval_type(x) != LVAL_NUM )
+            {
+            result = lval_err("if expects a number condition!");
+            goto error;
+            }
+        ip = lval_to_num(x) == 0 ? p->code + VM_U16(ip) : ip + 2;
+        VM_DISPATCH();
+
+    VM_OP(CALL):
+        n = *ip++;
+        goto call;
+
+    VM_OP(RETURN):
+        result = *--sp;
+        if( depth == 0 )
+            {
+            m->sp = m->stack;
+            return result;
+            }
+
+        /* Drop the arguments and the function below them */
+        sp = base - 1;
+
+        depth--;
+        p = m->frames[depth].p;
+        ip = m->frames[depth].ip;
+        base = m->stack + m->frames[depth].base;
+        *sp++ = result;
+        VM_DISPATCH();
+
+    VM_OP(ADD):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( VM_FAST_ADD && lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, BUILTIN_ADD) )
+            {
+            sp[-2] = lval_num(lval_to_num(sp[-2]) + lval_to_num(sp[-1]));
+            sp--;
+            VM_DISPATCH();
+            }
+        goto fallback;
+
+    VM_OP(SUB):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( VM_FAST_ADD && lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, BUILTIN_SUB) )
+            {
+            sp[-2] = lval_num(lval_to_num(sp[-2]) - lval_to_num(sp[-1]));
+            sp--;
+            VM_DISPATCH();
+            }
+        goto fallback;
+
+    VM_OP(MUL):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, BUILTIN_MUL) )
+            {
+            a = lval_to_num(sp[-2]);
+            b = lval_to_num(sp[-1]);
+            if( a >= -VM_MUL_LIMIT && a <= VM_MUL_LIMIT && b >= -VM_MUL_LIMIT && b <= VM_MUL_LIMIT )
+                {
+                sp[-2] = lval_num(a * b);
+                sp--;
+                VM_DISPATCH();
+                }
+            }
+        goto fallback;
+
+    VM_OP(DIV):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, BUILTIN_DIV) )
+            {
+            a = lval_to_num(sp[-2]);
+            b = lval_to_num(sp[-1]);
+            if( b != 0 && b != -1 )
+                {
+                sp[-2] = lval_num(a / b);
+                sp--;
+                VM_DISPATCH();
+                }
+            }
+        goto fallback;
+
+    VM_OP(MOD):
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, BUILTIN_MOD) )
+            {
+            a = lval_to_num(sp[-2]);
+            b = lval_to_num(sp[-1]);
+            if( b != 0 && b != -1 )
+                {
+                sp[-2] = lval_num(a % b);
+                sp--;
+                VM_DISPATCH();
+                }
+            }
+        goto fallback;
+
+    VM_OP(LT):
+    VM_OP(GT):
+    VM_OP(LE):
+    VM_OP(GE):
+    VM_OP(EQ):
+    VM_OP(NE):
+        n = ip[-1] - OP_ADD;
+        s = p->globals[VM_U16(ip)];
+        ip += 2;
+        if( lval_is_int(sp[-2]) && lval_is_int(sp[-1]) && VM_BUILTIN(s, n) )
+            {
+            a = lval_to_num(sp[-2]);
+            b = lval_to_num(sp[-1]);
+            switch( n )
+                {
+                case BUILTIN_LT: a = a <  b; break;
+                case BUILTIN_GT: a = a >  b; break;
+                case BUILTIN_LE: a = a <= b; break;
+                case BUILTIN_GE: a = a >= b; break;
+                case BUILTIN_EQ: a = a == b; break;
+                default:         a = a != b; break;
+                }
+            sp[-2] = lval_num(a);
+            sp--;
+            VM_DISPATCH();
+            }
+        goto fallback;
+
+#ifndef CLISP_THREADED
+    default:
+        result = lval_err("Invalid bytecode!");
+        goto error;
+#endif
+    }
+
+/* A builtin op whose values or binding it cannot handle inline calls
+ * whatever the global is bound to, pushed under the two values */
+fallback:
+if( s->value == NULL )
+    {
+    result = lval_err("Unbound symbol!");
+    goto error;
+    }
+sp[0] = sp[-1];
+sp[-1] = sp[-2];
+sp[-2] = s->value;
+sp++;
+n = 2;
+
+call:
+/* Calls are where the collector runs, every value in use is then on
+ * the stack */
+if( heap.pending )
+    {
+    m->sp = sp;
+    gc_collect();
+    }
+
+f = sp[-n - 1];
+switch( lval_type(f) )
+    {
+    /* Builtins take their arguments as a list */
+    case LVAL_FUN:
+        x = lval_sexpr();
+        if( n > 0 )
+            {
+            x->cell_count = n;
+            x->data.cell = gc_cells(x, n);
+            memcpy(x->data.cell, sp - n, sizeof(lval*) * n);
+            }
+        sp -= n + 1;
+
+        result = f->data.fun->fun(x);
+        if( lval_type(result) == LVAL_ERR ) { goto error; }
+        *sp++ = result;
+        VM_DISPATCH();
+
+    /* Functions run in a new frame whose arguments are already on the
+     * stack, with the function itself below them */
+    case LVAL_LAMBDA:
+        if( n != f->data.fn->arity )
+            {
+            result = lval_err("Incorrect number of arguments!");
+            goto error;
+            }
+        if( f->data.fn->code == NULL )
+            {
+            f->data.fn->code = compile_form(f->data.fn, f->data.fn->body);
+            gc_remember(f);
+            }
+
+#ifdef CLISP_JIT
+        /* Hot functions are compiled to native code, which is run when
+         * every argument is an integer */
+        if( jit_mode != JIT_OFF
+         && f->data.fn->jit == JIT_PENDING
+         && ++f->data.fn->calls % JIT_THRESHOLD == 0 )
+            {
+            jit_compile(f->data.fn);
+            gc_remember(f);
+            }
+        if( f->data.fn->jit == JIT_READY && jit_mode != JIT_OFF && jit_call(f, sp - n, n, depth, &result) )
+            {
+            sp -= n + 1;
+            *sp++ = result;
+            VM_DISPATCH();
+            }
+#endif
+
+        if( depth == CALL_DEPTH_MAX )
+            {
+            result = lval_err("Too many nested calls!");
+            goto error;
+            }
+
+        if( depth == m->frames_capacity )
+            {
+            m->frames_capacity *= 2;
+            m->frames = realloc(m->frames, sizeof(vm_frame) * m->frames_capacity);
+            }
+        m->frames[depth].p = p;
+        m->frames[depth].ip = ip;
+        m->frames[depth].base = base - m->stack;
+        depth++;
+
+        p = f->data.fn->code;
+        ip = p->code;
+        n = (int)( sp - m->stack );
+        vm_reserve(m, n, p->stack);
+        sp = m->stack + n;
+        base = sp - f->data.fn->arity;
+        VM_DISPATCH();
+
+    default:
+        result = lval_err("S-expression does not start with a function!");
+        goto error;
+    }
+
+/* An error is the result of the whole form, as in the tree walker */
+error:
+m->sp = m->stack;
+return result;
+}
+
+#ifdef CLISP_JIT
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int jit_compile
+    (
+    lambda* fn
+    )
+{
+/* Functions which only do integer arithmetic on their arguments,
+ * integer globals and calls to such functions are compiled. Values are
+ * plain longs in slots on the native stack, and anything the code
+ * cannot handle, such as overflow, returns 0 so the VM runs the call
+ * instead. The code has no side effects, so running it again is
+ * safe. */
+const proto* p = fn->code;
+jit_emitter e;
+int* depth;
+lval** callee;
+lval** callees = NULL;
+int callees_num = 0;
+int supported = 1;
+int retry = 0;
+int reachable = 1;
+int d = 0;
+size_t page;
+jit_code* j;
+
+if( fn->arity > JIT_MAX_ARGS )
+    {
+    fn->jit = JIT_UNSUPPORTED;
+    return 0;
+    }
+
+memset(&e, 0, sizeof(e));
+e.labels = malloc(sizeof(int) * ( p->code_length + 1 ));
+depth = malloc(sizeof(int) * ( p->code_length + 1 ));
+callee = calloc(p->stack + 1, sizeof(lval*));
+for( int i = 0; i <= p->code_length; ++i ) { depth[i] = -1; }
+
+/* push rbp; mov rbp, rsp; push rbx; push r12; sub rsp, frame;
+ * mov rbx, rdi; mov r12, rsi. The frame keeps rsp 16-byte aligned. */
+jit_bytes(&e, 6, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x41);
+jit_bytes(&e, 4, 0x54, 0x48, 0x81, 0xEC);
+jit_u32(&e, ( p->stack * 8 + 15 ) & ~15);
+jit_bytes(&e, 6, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4);
+
+/* mov rax, &jit_calls_left; dec qword [rax]; js bail. Every exit
+ * from here on gives the call back in the epilogue. */
+jit_bytes(&e, 2, 0x48, 0xB8);
+jit_u64(&e, (uint64_t)(uintptr_t)&jit_calls_left);
+jit_bytes(&e, 3, 0x48, 0xFF, 0x08);
+jit_jump(&e, 0x88, -1);
+
+/* mov rax, &jit_stack_limit; cmp rsp, [rax]; jb bail */
+jit_bytes(&e, 2, 0x48, 0xB8);
+jit_u64(&e, (uint64_t)(uintptr_t)&jit_stack_limit);
+jit_bytes(&e, 3, 0x48, 0x3B, 0x20);
+jit_jump(&e, 0x82, -1);
+
+/* The bindings the code depends on are checked once on entry, nothing
+ * it runs can change them */
+for( int pc = 0; pc < p->code_length && supported; pc += jit_op_size(p->code[pc]) )
+    {
+    int op = p->code[pc];
+    symbol* s;
+    lval* x;
+
+    if( op != OP_GLOBAL && ( op < OP_ADD || op > OP_NE ) ) { continue; }
+    s = p->globals[p->code[pc + 1] | ( p->code[pc + 2] << 8 )];
+    x = s->value;
+
+    /* mov rax, s; mov rax, [rax + value] */
+    jit_bytes(&e, 2, 0x48, 0xB8);
+    jit_u64(&e, (uint64_t)(uintptr_t)s);
+    jit_bytes(&e, 4, 0x48, 0x8B, 0x40, (int)offsetof(symbol, value));
+
+    /* test al, 1, integers jump past the rest when still integers */
+    jit_bytes(&e, 2, 0xA8, 0x01);
+    if( op == OP_GLOBAL && x && lval_is_int(x) )
+        {
+        jit_jump(&e, 0x84, -1);
+        continue;
+        }
+    jit_jump(&e, 0x85, -1);
+
+    /* test rax, rax; jz bail; cmp byte [rax + type], type */
+    jit_bytes(&e, 3, 0x48, 0x85, 0xC0);
+    jit_jump(&e, 0x84, -1);
+    jit_bytes(&e, 3, 0x80, 0x78, (int)offsetof(lval, type));
+    jit_bytes(&e, 1, op == OP_GLOBAL ? LVAL_LAMBDA : LVAL_FUN);
+    jit_jump(&e, 0x85, -1);
+
+    /* mov rcx, data; cmp [rax + data], rcx; jne bail */
+    jit_bytes(&e, 2, 0x48, 0xB9);
+    if( op == OP_GLOBAL )
+        {
+        if( x == NULL || lval_type(x) != LVAL_LAMBDA ) { supported = 0; }
+        jit_u64(&e, supported ? (uint64_t)(uintptr_t)x->data.fn : 0);
+        }
+    else
+        {
+        if( !VM_BUILTIN(s, op - OP_ADD) ) { supported = 0; }
+        jit_u64(&e, (uint64_t)(uintptr_t)&builtins[op - OP_ADD]);
+        }
+    jit_bytes(&e, 4, 0x48, 0x39, 0x48, (int)offsetof(lval, data));
+    jit_jump(&e, 0x85, -1);
+    }
+
+/* Translate each op, tracking how deep the operand stack is */
+for( int pc = 0; pc < p->code_length && supported; pc += jit_op_size(p->code[pc]) )
+    {
+    int op = p->code[pc];
+    int k = p->code_length > pc + 2 ? p->code[pc + 1] | ( p->code[pc + 2] << 8 ) : 0;
+    const lambda* g;
+    lval* x;
+
+    /* Only forward jumps are compiled, code after a jump or return is
+     * reached by one. Functions are never carried across a jump, so
+     * no slot at a jump target holds one. */
+    if( depth[pc] >= 0 )
+        {
+        if( reachable && jit_holds_callee(callee, 0, d) ) { supported = 0; break; }
+        d = depth[pc];
+        memset(callee, 0, sizeof(lval*) * ( p->stack + 1 ));
+        reachable = 1;
+        }
+    if( !reachable )
+        {
+        supported = 0;
+        break;
+        }
+    e.labels[pc] = e.length;
+
+    switch( op )
+        {
+        case OP_CONST:
+            x = p->constants[k];
+            if( !lval_is_int(x) ) { supported = 0; break; }
+            jit_bytes(&e, 2, 0x48, 0xB8);
+            jit_u64(&e, (uint64_t)lval_to_num(x));
+            jit_slot(&e, 0x89, 0x84, d);
+            callee[d++] = NULL;
+            break;
+
+        case OP_LOCAL:
+            /* mov rax, [rbx + 8 * i] */
+            jit_bytes(&e, 3, 0x48, 0x8B, 0x83);
+            jit_u32(&e, p->code[pc + 1] * 8);
+            jit_slot(&e, 0x89, 0x84, d);
+            callee[d++] = NULL;
+            break;
+
+        case OP_GLOBAL:
+            /* Functions are only called, their slot is not written. Any
+             * op but the call which takes the slot as its function
+             * rejects it, as do jumps while it is on the stack. */
+            x = p->globals[k]->value;
+            callee[d] = NULL;
+            if( lval_is_int(x) )
+                {
+                /* mov rax, s; mov rax, [rax + value]; sar rax, 1 */
+                jit_bytes(&e, 2, 0x48, 0xB8);
+                jit_u64(&e, (uint64_t)(uintptr_t)p->globals[k]);
+                jit_bytes(&e, 4, 0x48, 0x8B, 0x40, (int)offsetof(symbol, value));
+                jit_bytes(&e, 3, 0x48, 0xD1, 0xF8);
+                jit_slot(&e, 0x89, 0x84, d);
+                }
+            else
+                {
+                callee[d] = x;
+                }
+            d++;
+            break;
+
+        case OP_JUMP:
+            if( jit_holds_callee(callee, 0, d) ) { supported = 0; break; }
+            jit_bytes(&e, 1, 0xE9);
+            jit_fixup(&e, k);
+            depth[k] = d;
+            reachable = 0;
+            break;
+
+        case OP_JUMP_FALSE:
+            /* mov rax, [slot]; test rax, rax; jz a */
+            if( jit_holds_callee(callee, 0, d) ) { supported = 0; break; }
+            jit_slot(&e, 0x8B, 0x84, --d);
+            jit_bytes(&e, 3, 0x48, 0x85, 0xC0);
+            jit_jump(&e, 0x84, k);
+            depth[k] = d;
+            break;
+
+        case OP_CALL:
+            /* The arguments are already an array on the stack, the
+             * result replaces the function below them */
+            k = p->code[pc + 1];
+            g = callee[d - k - 1] ? callee[d - k - 1]->data.fn : NULL;
+            if( jit_holds_callee(callee, d - k, d) ) { supported = 0; break; }
+            if( g == NULL || g->arity != k || ( g != fn && g->jit != JIT_READY ) )
+                {
+                retry = g && g->arity == k && g->jit == JIT_PENDING;
+                supported = 0;
+                break;
+                }
+            jit_slot(&e, 0x8D, 0xBC, d - k);
+            jit_slot(&e, 0x8D, 0xB4, d - k - 1);
+            if( g == fn )
+                {
+                /* call self */
+                jit_bytes(&e, 1, 0xE8);
+                jit_u32(&e, (uint32_t)( 0 - ( e.length + 4 ) ));
+                }
+            else
+                {
+                /* mov rax, entry; call rax */
+                jit_bytes(&e, 2, 0x48, 0xB8);
+                jit_u64(&e, (uint64_t)(uintptr_t)g->native->entry);
+                jit_bytes(&e, 2, 0xFF, 0xD0);
+                callees = realloc(callees, sizeof(lval*) * ( callees_num + 1 ));
+                callees[callees_num++] = callee[d - k - 1];
+                }
+
+            /* test eax, eax; jz bail */
+            jit_bytes(&e, 2, 0x85, 0xC0);
+            jit_jump(&e, 0x84, -1);
+            d -= k;
+            callee[d - 1] = NULL;
+            break;
+
+        case OP_RETURN:
+            /* mov rax, [slot]; mov [r12], rax; mov eax, 1 */
+            if( callee[d - 1] ) { supported = 0; break; }
+            jit_slot(&e, 0x8B, 0x84, --d);
+            jit_bytes(&e, 4, 0x49, 0x89, 0x04, 0x24);
+            jit_bytes(&e, 5, 0xB8, 0x01, 0x00, 0x00, 0x00);
+            jit_epilogue(&e);
+            reachable = 0;
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+            /* mov rax, [a]; op rax, [b]; jo bail; mov [a], rax */
+            if( jit_holds_callee(callee, d - 2, d) ) { supported = 0; break; }
+            jit_slot(&e, 0x8B, 0x84, d - 2);
+            if( op == OP_ADD ) { jit_slot(&e, 0x03, 0x84, d - 1); }
+            if( op == OP_SUB ) { jit_slot(&e, 0x2B, 0x84, d - 1); }
+            if( op == OP_MUL )
+                {
+                jit_bytes(&e, 5, 0x48, 0x0F, 0xAF, 0x84, 0x24);
+                jit_u32(&e, ( d - 1 ) * 8);
+                }
+            jit_jump(&e, 0x80, -1);
+            jit_slot(&e, 0x89, 0x84, d - 2);
+            d--;
+            break;
+
+        case OP_DIV:
+        case OP_MOD:
+            /* mov rcx, [b]; test rcx, rcx; jz bail; cmp rcx, -1; je bail;
+             * mov rax, [a]; cqo; idiv rcx; mov [a], rax or rdx. Zero
+             * and -1 divisors are left to the builtins. */
+            if( jit_holds_callee(callee, d - 2, d) ) { supported = 0; break; }
+            jit_slot(&e, 0x8B, 0x8C, d - 1);
+            jit_bytes(&e, 3, 0x48, 0x85, 0xC9);
+            jit_jump(&e, 0x84, -1);
+            jit_bytes(&e, 4, 0x48, 0x83, 0xF9, 0xFF);
+            jit_jump(&e, 0x84, -1);
+            jit_slot(&e, 0x8B, 0x84, d - 2);
+            jit_bytes(&e, 5, 0x48, 0x99, 0x48, 0xF7, 0xF9);
+            jit_slot(&e, 0x89, op == OP_DIV ? 0x84 : 0x94, d - 2);
+            d--;
+            break;
+
+        case OP_LT:
+        case OP_GT:
+        case OP_LE:
+        case OP_GE:
+        case OP_EQ:
+        case OP_NE:
+            /* mov rax, [a]; cmp rax, [b]; setcc al; movzx eax, al;
+             * mov [a], rax */
+            if( jit_holds_callee(callee, d - 2, d) ) { supported = 0; break; }
+            jit_slot(&e, 0x8B, 0x84, d - 2);
+            jit_slot(&e, 0x3B, 0x84, d - 1);
+            jit_bytes(&e, 6, 0x0F, jit_setcc[op - OP_LT], 0xC0, 0x0F, 0xB6, 0xC0);
+            jit_slot(&e, 0x89, 0x84, d - 2);
+            d--;
+            break;
+
+        /* Values other than integers, errors and definitions are left
+         * to the VM */
+        default:
+            supported = 0;
+            break;
+        }
+    }
+
+/* bail: xor eax, eax */
+e.bail = e.length;
+jit_bytes(&e, 2, 0x31, 0xC0);
+jit_epilogue(&e);
+
+free(depth);
+free(callee);
+
+if( !supported )
+    {
+    /* Functions it calls may be compiled later */
+    fn->jit = retry ? JIT_PENDING : JIT_UNSUPPORTED;
+    free(callees);
+    jit_emitter_free(&e);
+    return 0;
+    }
+
+/* Resolve the jumps and copy the code to executable memory */
+for( int i = 0; i < e.fixups_num; ++i )
+    {
+    int to = e.targets[i] < 0 ? e.bail : e.labels[e.targets[i]];
+    uint32_t rel = (uint32_t)( to - ( e.fixups[i] + 4 ) );
+    memcpy(e.code + e.fixups[i], &rel, 4);
+    }
+
+page = (size_t)sysconf(_SC_PAGESIZE);
+j = malloc(sizeof(jit_code));
+j->size = ( e.length + page - 1 ) / page * page;
+j->memory = mmap(NULL, j->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+if( j->memory == MAP_FAILED )
+    {
+    free(j);
+    free(callees);
+    jit_emitter_free(&e);
+    fn->jit = JIT_DISABLED;
+    return 0;
+    }
+memcpy(j->memory, e.code, e.length);
+mprotect(j->memory, j->size, PROT_READ | PROT_EXEC);
+j->entry = (jit_entry)(uintptr_t)j->memory;
+
+/* The collector keeps the functions called directly, and so their
+ * code, alive */
+j->callees = callees;
+j->callees_num = callees_num;
+
+fn->native = j;
+fn->jit = JIT_READY;
+jit_emitter_free(&e);
+return 1;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_free
+    (
+    jit_code* j
+    )
+{
+munmap(j->memory, j->size);
+free(j->callees);
+free(j);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int jit_call
+    (
+    lval* f,
+    lval** args,
+    int n,
+    size_t depth,
+    lval** result
+    )
+{
+lambda* fn = f->data.fn;
+long values[JIT_MAX_ARGS];
+long x;
+char here;
+
+/* Native code only takes integers */
+for( int i = 0; i < n; ++i )
+    {
+    if( !lval_is_int(args[i]) ) { return 0; }
+    values[i] = lval_to_num(args[i]);
+    }
+
+/* Leave native code well before the end of the C stack, or when it
+ * nests deeper than the VM would */
+jit_stack_limit = (uintptr_t)&here - JIT_STACK_BYTES;
+jit_calls_left = CALL_DEPTH_MAX - (long)depth;
+
+if( !fn->native->entry(values, &x) )
+    {
+    /* Code that keeps bailing out is not worth entering */
+    if( ++fn->bails >= JIT_MAX_BAILS ) { fn->jit = JIT_DISABLED; }
+    return 0;
+    }
+
+*result = lval_num(x);
+
+/* Check the result against the tree walker, which wins */
+if( jit_mode == JIT_VERIFY )
+    {
+    lval* a = lval_sexpr();
+    lval* y;
+
+    for( int i = 0; i < n; ++i ) { a = lval_add(a, args[i]); }
+    call_depth = (int)depth;
+    y = lval_call(f, a);
+    call_depth = 0;
+    if( lval_type(y) != LVAL_NUM || lval_to_num(y) != x )
+        {
+        printf("jit: mismatch calling ");
+        lval_print(f);
+        printf(": native %ld, interpreter ", x);
+        lval_println(y);
+        *result = y;
+        }
+    }
+
+return 1;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int jit_op_size
+    (
+    int op
+    )
+{
+switch( op )
+    {
+    case OP_NIL:
+    case OP_RETURN:
+        return 1;
+    case OP_LOCAL:
+    case OP_CALL:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int jit_holds_callee
+    (
+    lval** callee,
+    int from,
+    int to
+    )
+{
+/* Whether any of the slots holds a function rather than an integer */
+for( int i = from; i < to; ++i )
+    {
+    if( callee[i] ) { return 1; }
+    }
+return 0;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_bytes
+    (
+    jit_emitter* e,
+    int n,
+    ...
+    )
+{
+va_list bytes;
+
+if( e->length + n > e->capacity )
+    {
+    e->capacity = e->capacity ? e->capacity * 2 + n : 256;
+    e->code = realloc(e->code, e->capacity);
+    }
+
+va_start(bytes, n);
+for( int i = 0; i < n; ++i )
+    {
+    e->code[e->length++] = (unsigned char)va_arg(bytes, int);
+    }
+va_end(bytes);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_u32
+    (
+    jit_emitter* e,
+    uint32_t x
+    )
+{
+jit_bytes(e, 4, x & 0xFF, ( x >> 8 ) & 0xFF, ( x >> 16 ) & 0xFF, ( x >> 24 ) & 0xFF);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_u64
+    (
+    jit_emitter* e,
+    uint64_t x
+    )
+{
+jit_u32(e, (uint32_t)x);
+jit_u32(e, (uint32_t)( x >> 32 ));
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_slot
+    (
+    jit_emitter* e,
+    int op,
+    int modrm,
+    int slot
+    )
+{
+/* A 64-bit op on [rsp + 8 * slot], the register is in modrm */
+jit_bytes(e, 4, 0x48, op, modrm, 0x24);
+jit_u32(e, slot * 8);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_jump
+    (
+    jit_emitter* e,
+    int cc,
+    int target
+    )
+{
+/* A conditional jump to an op, or to the bail out when -1 */
+jit_bytes(e, 2, 0x0F, cc);
+jit_fixup(e, target);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_fixup
+    (
+    jit_emitter* e,
+    int target
+    )
+{
+e->fixups = realloc(e->fixups, sizeof(int) * ( e->fixups_num + 1 ));
+e->targets = realloc(e->targets, sizeof(int) * ( e->fixups_num + 1 ));
+e->fixups[e->fixups_num] = e->length;
+e->targets[e->fixups_num] = target;
+e->fixups_num++;
+jit_u32(e, 0);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_epilogue
+    (
+    jit_emitter* e
+    )
+{
+/* mov rcx, &jit_calls_left; inc qword [rcx] */
+jit_bytes(e, 2, 0x48, 0xB9);
+jit_u64(e, (uint64_t)(uintptr_t)&jit_calls_left);
+jit_bytes(e, 3, 0x48, 0xFF, 0x01);
+
+/* lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret */
+jit_bytes(e, 9, 0x48, 0x8D, 0x65, 0xF0, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void jit_emitter_free
+    (
+    jit_emitter* e
+    )
+{
+free(e->code);
+free(e->fixups);
+free(e->targets);
+free(e->labels);
+}
+#endif
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_read
+    (
+    mpc_ast_t* t
+    )
+{
+/* If Symbol or Number return conversion to that type */
+if( strstr(t->tag, "number") ) { return lval_read_num(t); }
+if( strstr(t->tag, "symbol") ) { return lval_sym(t->contents); }
+
+/* If root (>) or sexpr then create empty list */
+lval* x = NULL;
+if( strcmp(t->tag, ">") == 0 ) { x = lval_sexpr(); }
+if( strstr(t->tag, "sexpr") )  { x = lval_sexpr(); }
+
+/* Fill empty list with valid expressions from children */
+for( int i = 0; i < t->children_num; ++i )
+    {
+    // TODO: Why do we ignore brackets?
+    if( strcmp(t->children[i]->contents, "(") == 0 ) { continue; }
+    if( strcmp(t->children[i]->contents, ")") == 0 ) { continue; }
+    if( strcmp(t->children[i]->tag,  "regex") == 0 ) { continue; }
+    x = lval_add(x, lval_read(t->children[i]));
+    }
+
+return x;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_read_num
+    (
+    mpc_ast_t* t
+    )
+{
+/* Convert str->long, the scanner reports overflow itself */
+long num;
+int overflow;
+
+mpc_scan_long(t->contents, (long)strlen(t->contents), &num, &overflow);
+return !overflow
+    ? lval_num(num)
+    : lval_err("Invalid number");
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_add
+    (
+    lval* v,
+    lval* x
+    )
+{
+/* The array is full when the count is 0 or a power of two */
+if( ( v->cell_count & ( v->cell_count - 1 ) ) == 0 )
+    {
+    lval** cells = gc_cells(v, v->cell_count + 1);
+    if( v->cell_count > 0 )
+        {
+        memcpy(cells, v->data.cell, sizeof(lval*) * v->cell_count);
+        }
+    gc_release_cells(v->data.cell, v->cell_count);
+    v->data.cell = cells;
+    }
+
+v->data.cell[v->cell_count++] = x;
+gc_barrier(v, x);
+return v;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_join
+    (
+    lval* x,
+    lval* y
+    )
+{
+/* Move all elements of y to the end of x, the empty y is collected */
+for( int i = 0; i < y->cell_count; ++i )
+    {
+    x = lval_add(x, y->data.cell[i]);
+    }
+
+return x;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_init
+    (
+    reader* r
+    )
+{
+r->capacity = 256;
+r->text = malloc(r->capacity);
+reader_clear(r);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_free
+    (
+    reader* r
+    )
+{
+free(r->text);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_clear
+    (
+    reader* r
+    )
+{
+/* Keep the buffer for the next input */
+r->text[0] = '\0';
+r->length = 0;
+r->complete = 0;
+r->depth = 0;
+r->unbalanced = 0;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int reader_feed
+    (
+    reader* r,
+    const char* line
+    )
+{
+size_t start = r->length;
+size_t line_length = strlen(line);
+
+/* Lines after the first are joined with the newline readline removed */
+if( ( r->length + line_length + 2 ) > r->capacity )
+    {
+    while( ( r->length + line_length + 2 ) > r->capacity )
+        {
+        r->capacity *= 2;
+        }
+    r->text = realloc(r->text, r->capacity);
+    }
+
+if( r->length > 0 )
+    {
+    r->text[r->length++] = '\n';
+    }
+memcpy(r->text + r->length, line, line_length + 1);
+r->length += line_length;
+
+/* Only scan the new characters, the depth of the rest is known */
+reader_scan(r, start);
+
+/* A stray closing bracket is complete too, so that the parser can
+ * report it */
+return r->depth == 0 || r->unbalanced;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_append
+    (
+    reader* r,
+    const char* text,
+    size_t length
+    )
+{
+size_t start = r->length;
+
+/* Raw input is appended as is, newlines included */
+if( ( r->length + length + 1 ) > r->capacity )
+    {
+    while( ( r->length + length + 1 ) > r->capacity )
+        {
+        r->capacity *= 2;
+        }
+    r->text = realloc(r->text, r->capacity);
+    }
+
+memcpy(r->text + r->length, text, length);
+r->length += length;
+r->text[r->length] = '\0';
+
+reader_scan(r, start);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_consume
+    (
+    reader* r,
+    size_t length
+    )
+{
+/* Move the unfinished rest to the front and scan it again from the
+ * top level, it is at most the last line */
+memmove(r->text, r->text + length, r->length - length + 1);
+r->length -= length;
+r->complete = 0;
+r->depth = 0;
+r->unbalanced = 0;
+reader_scan(r, 0);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void reader_scan
+    (
+    reader* r,
+    size_t start
+    )
+{
+for( size_t i = start; i < r->length; ++i )
+    {
+    if( r->text[i] == '(' ) { r->depth++; }
+    if( r->text[i] == ')' ) { r->depth--; }
+    if( r->depth < 0 )      { r->unbalanced = 1; }
+
+    /* Input up to a line ending outside any list holds whole forms */
+    if( r->text[i] == '\n' && r->depth <= 0 ) { r->complete = i + 1; }
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void form_cache_init
+    (
+    form_cache* c
+    )
+{
+memset(c, 0, sizeof(form_cache));
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void form_cache_free
+    (
+    form_cache* c
+    )
+{
+for( int i = 0; i < FORM_CACHE_SLOTS; ++i )
+    {
+    free(c->slots[i].text);
+    if( c->slots[i].ast ) { mpc_ast_delete(c->slots[i].ast); }
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+mpc_ast_t* form_cache_parse
+    (
+    form_cache* c,
+    mpc_ctx_t* context,
+    mpc_parser_t* program,
+    const char* text,
+    size_t length
+    )
+{
+form_cache_entry* entry;
+mpc_result_t r;
+
+/* The hash of the form's text picks its slot */
+unsigned long hash = text_hash(text, length);
+
+entry = &c->slots[hash % FORM_CACHE_SLOTS];
+if( entry->ast
+ && entry->hash == hash
+ && entry->length == length
+ && memcmp(entry->text, text, length) == 0 )
+    {
+    return entry->ast;
+    }
+
+/* Errors are not cached, the caller reparses the whole input to
+ * report them */
+if( !mpc_ctx_nparse(context, "<stdin>", text, length, program, &r) )
+    {
+    mpc_err_delete(r.error);
+    return NULL;
+    }
+
+/* Replace whatever form was in the slot before */
+free(entry->text);
+if( entry->ast ) { mpc_ast_delete(entry->ast); }
+
+entry->hash = hash;
+entry->length = length;
+entry->text = malloc(length);
+memcpy(entry->text, text, length);
+entry->ast = r.output;
+
+return entry->ast;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* read_program
+    (
+    form_cache* c,
+    mpc_ctx_t* context,
+    mpc_parser_t* program,
+    reader* r,
+    mpc_err_t** error
+    )
+{
+const char* space = " \f\n\r\t\v";
+mpc_result_t result;
+mpc_ast_t* form;
+lval* x;
+size_t start = 0;
+size_t end;
+int depth;
+
+x = lval_sexpr();
+
+/* Split the input into its top-level forms, bracketed lists and runs of
+ * atoms, and read each through the cache. Forms which did not change
+ * since they were last entered are not parsed again. */
+while( !r->unbalanced )
+    {
+    while( start < r->length && strchr(space, r->text[start]) ) { ++start; }
+    if( start == r->length )
+        {
+        return x;
+        }
+
+    end = start;
+    if( r->text[start] == '(' )
+        {
+        depth = 0;
+        do
+            {
+            if( r->text[end] == '(' ) { depth++; }
+            if( r->text[end] == ')' ) { depth--; }
+            ++end;
+            }
+        while( depth > 0 );
+        }
+    else
+        {
+        while( end < r->length
+            && !strchr(space, r->text[end])
+            && r->text[end] != '('
+            && r->text[end] != ')' )
+            {
+            ++end;
+            }
+        }
+
+    form = form_cache_parse(c, context, program, r->text + start, end - start);
+    if( form == NULL )
+        {
+        break;
+        }
+
+    x = lval_join(x, lval_read(form));
+    start = end;
+    }
+
+/* Parse the whole input so errors are reported at their position in
+ * it rather than in a single form */
+if( mpc_ctx_nparse(context, "<stdin>", r->text, r->length, program, &result) )
+    {
+    x = lval_read(result.output);
+    mpc_ast_delete(result.output);
+    return x;
+    }
+
+*error = result.error;
+return NULL;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+char* load_file
+    (
+    const char* filename,
+    size_t* length
+    )
+{
+FILE* file;
+char* text;
+long size;
+
+file = fopen(filename, "rb");
+if( file == NULL )
+    {
+    return NULL;
+    }
+
+/* Read the whole file so it is parsed in a single pass */
+fseek(file, 0, SEEK_END);
+size = ftell(file);
+fseek(file, 0, SEEK_SET);
+
+text = malloc(size + 1);
+*length = fread(text, 1, size, file);
+text[*length] = '\0';
+
+fclose(file);
+return text;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int load_program
+    (
+    const char* filename,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    )
+{
+mpc_state_t start = { 0, 0, 0 };
+size_t length;
+char* text;
+int ok;
+
+text = load_file(filename, &length);
+if( text == NULL )
+    {
+    printf("%s: error: Unable to open file!\n", filename);
+    return 0;
+    }
+
+ok = load_forms(filename, text, length, start, expression, context);
+
+free(text);
+return ok;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int load_stream
+    (
+    FILE* stream,
+    const char* filename,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    )
+{
+reader r;
+mpc_state_t start = { 0, 0, 0 };
+char* chunk;
+long length;
+int ok = 1;
+
+reader_init(&r);
+chunk = malloc(STREAM_CHUNK);
+
+/* Take whatever input is available, up to a chunk, and load the whole
+ * lines of forms it completes straight away, keeping the rest until
+ * more input arrives */
+while( ( length = (long)read(fileno(stream), chunk, STREAM_CHUNK) ) != 0 )
+    {
+    if( length < 0 )
+        {
+        if( errno == EINTR ) { continue; }
+        break;
+        }
+
+    reader_append(&r, chunk, (size_t)length);
+    if( r.complete == 0 )
+        {
+        continue;
+        }
+
+    if( !load_forms(filename, r.text, r.complete, start, expression, context) ) { ok = 0; }
+
+    /* Later forms are reported at their position in the whole stream */
+    start.pos += (long)r.complete;
+    for( size_t i = 0; i < r.complete; ++i )
+        {
+        if( r.text[i] == '\n' ) { start.row++; }
+        }
+
+    reader_consume(&r, r.complete);
+
+    /* Show the results before waiting for more input */
+    fflush(stdout);
+    }
+
+/* Whatever is left at the end of input, complete or not */
+if( r.length > 0 && !load_forms(filename, r.text, r.length, start, expression, context) ) { ok = 0; }
+
+free(chunk);
+reader_free(&r);
+return ok;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int load_forms
+    (
+    const char* filename,
+    const char* text,
+    size_t length,
+    mpc_state_t start,
+    mpc_parser_t* expression,
+    mpc_ctx_t* context
+    )
+{
+mpc_recovery_t r;
+int errors = 0;
+int ok;
+
+/* Parse every top-level expression, skipping past the bracketed form
+ * of any that fail so the rest of the file is still read. A form with
+ * bytes which are not UTF-8 fails at the first of them, and one which
+ * takes more steps than the context allows fails where it ran out. */
+ok = mpc_ctx_nparse_recover(context, filename, text, length, expression, "(", ")", &r);
+
+for( int i = 0; i < r.outputs_num; ++i )
+    {
+    mpc_ast_t* form = r.outputs[i];
+    lval* x;
+
+    /* Errors are reported where their forms are, among the results */
+    while( errors < r.errors_num && r.errors[errors]->state.pos < form->state.pos )
+        {
+        load_error(r.errors[errors++], start);
+        }
+
+    x = lval_read(form);
+
+    /* Lists come wrapped in a root node, evaluate each form inside it.
+     * The list is kept while its forms run. */
+    if( strcmp(form->tag, ">") == 0 )
+        {
+        gc_protect(&x);
+        for( int j = 0; j < x->cell_count; ++j )
+            {
+            eval_print(x->data.cell[j]);
+            }
+        gc_unprotect();
+        }
+    else
+        {
+        eval_print(x);
+        }
+    }
+
+while( errors < r.errors_num )
+    {
+    load_error(r.errors[errors++], start);
+    }
+
+mpc_recovery_clear(&r, (mpc_dtor_t)mpc_ast_delete);
+return ok;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void load_error
+    (
+    mpc_err_t* error,
+    mpc_state_t start
+    )
+{
+/* Errors are positioned within the text, move them to where it
+ * starts in the input. It always starts at the beginning of a line. */
+error->state.pos += start.pos;
+error->state.row += start.row;
+mpc_err_print(error);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_num
+    (
+    long num
+    )
+{
+lval* lisp_value;
+
+/* Small integers are kept in the word, shifted past the tag bit */
+if( num >= LVAL_INT_MIN && num <= LVAL_INT_MAX )
+    {
+    return (lval*)( ( (uintptr_t)num << 1 ) | 1 );
+    }
+
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_NUM;
+lisp_value->data.num = num;
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_err
+    (
+    char* msg
+    )
+{
+lval* lisp_value;
+
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_ERR;
+lisp_value->data.err = gc_is_young(lisp_value) ? gc_region_alloc(strlen(msg) + 1) : NULL;
+if( lisp_value->data.err == NULL )
+    {
+    lisp_value->data.err = malloc(strlen(msg) + 1);
+    if( gc_is_young(lisp_value) ) { gc_push(&heap.finalizable, lisp_value); }
+    }
+strcpy(lisp_value->data.err, msg);
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_sym
+    (
+    const char* name
+    )
+{
+lval* lisp_value;
+
+/* The name is interned, the value only points at it */
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_SYM;
+lisp_value->data.sym = symbol_intern(&symbols, name, strlen(name));
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_fun
+    (
+    const builtin* b
+    )
+{
+lval* lisp_value;
+
+/* The name is printed from the builtin table, it is not copied */
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_FUN;
+lisp_value->data.fun = b;
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_sexpr
+    (
+    void
+    )
+{
+lval* lisp_value;
+
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_SEXPR;
+lisp_value->data.cell = NULL;
+lisp_value->cell_count = 0;
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* lval_lambda
+    (
+    lval* formals,
+    lval* body
+    )
+{
+lval* lisp_value;
+lambda* fn;
+
+/* Compiled the first time the VM calls it */
+fn = malloc(sizeof(lambda));
+fn->arity = formals->cell_count;
+fn->formals = formals;
+fn->body = body;
+fn->code = NULL;
+fn->calls = 0;
+fn->bails = 0;
+fn->jit = JIT_PENDING;
+fn->native = NULL;
+
+lisp_value = gc_alloc();
+lisp_value->type = LVAL_LAMBDA;
+lisp_value->data.fn = fn;
+gc_barrier(lisp_value, formals);
+gc_barrier(lisp_value, body);
+if( gc_is_young(lisp_value) ) { gc_push(&heap.finalizable, lisp_value); }
+
+return lisp_value;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void lambda_free
+    (
+    lambda* fn
+    )
+{
+/* The formals and body are values on the heap, swept on their own */
+if( fn->code ) { proto_free(fn->code); }
+#ifdef CLISP_JIT
+if( fn->native ) { jit_free(fn->native); }
+#endif
+free(fn);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_init
+    (
+    void
+    )
+{
+memset(&heap, 0, sizeof(heap));
+heap.nursery = malloc(sizeof(lval) * GC_NURSERY);
+heap.nursery_top = heap.nursery;
+heap.nursery_end = heap.nursery + GC_NURSERY;
+heap.region = malloc(GC_REGION);
+heap.region_top = heap.region;
+heap.region_end = heap.region + GC_REGION;
+heap.threshold = GC_MIN_THRESHOLD;
+heap.epoch = 1;
+
+/* Every step does at least some work whatever the target */
+heap.pause_target = (clock_t)( (double)gc_pause * CLOCKS_PER_SEC / 1000000 );
+if( heap.pause_target < 1 ) { heap.pause_target = 1; }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_free
+    (
+    void
+    )
+{
+/* Everything still in use at exit is freed with its chunk */
+for( lval* v = heap.nursery; v < heap.nursery_top; ++v )
+    {
+    gc_finalize(v);
+    }
+
+for( int i = 0; i < heap.chunks_num; ++i )
+    {
+    for( int j = 0; j < GC_CHUNK; ++j )
+        {
+        gc_finalize(&heap.chunks[i][j]);
+        }
+    free(heap.chunks[i]);
+    }
+
+slab_free();
+free(heap.nursery);
+free(heap.region);
+free(heap.bound);
+free(heap.finalizable.items);
+free(heap.remembered.items);
+free(heap.copied.items);
+free(heap.gray.items);
+free(heap.chunks);
+free(heap.roots);
+memset(&heap, 0, sizeof(heap));
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* gc_alloc
+    (
+    void
+    )
+{
+heap.allocated++;
+if( heap.nursery_top < heap.nursery_end )
+    {
+    return heap.nursery_top++;
+    }
+
+/* Until the next safe point values go straight to the old
+ * generation */
+heap.pending = 1;
+return gc_alloc_old();
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval* gc_alloc_old
+    (
+    void
+    )
+{
+lval* v;
+
+/* Add a chunk when every cell is in use. Its cells are chained in
+ * order so they are handed out in order. */
+if( heap.free == NULL )
+    {
+    lval* chunk = malloc(sizeof(lval) * GC_CHUNK);
+    heap.chunks = realloc(heap.chunks, sizeof(lval*) * ( heap.chunks_num + 1 ));
+    heap.chunks[heap.chunks_num++] = chunk;
+    for( int i = GC_CHUNK - 1; i >= 0; --i )
+        {
+        chunk[i].type = LVAL_FREE;
+        chunk[i].data.next = heap.free;
+        heap.free = &chunk[i];
+        }
+    }
+
+/* Allocated black, it survives a collection in progress */
+v = heap.free;
+heap.free = v->data.next;
+v->marked = heap.epoch;
+v->remembered = 0;
+
+/* Start a major collection once the old generation has doubled */
+if( ++heap.live >= heap.threshold && heap.phase == GC_IDLE )
+    {
+    heap.pending = 1;
+    heap.major = 1;
+    }
+if( heap.phase != GC_IDLE ) { heap.debt += GC_PACE; }
+
+return v;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int gc_is_young
+    (
+    const lval* v
+    )
+{
+return v >= heap.nursery && v < heap.nursery_end;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void* gc_region_alloc
+    (
+    size_t size
+    )
+{
+void* p;
+
+/* Once the region is full, collect at the next safe point */
+size = ( size + sizeof(void*) - 1 ) & ~( sizeof(void*) - 1 );
+if( (size_t)( heap.region_end - heap.region_top ) < size )
+    {
+    heap.pending = 1;
+    return NULL;
+    }
+
+p = heap.region_top;
+heap.region_top += size;
+return p;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int gc_in_region
+    (
+    const void* p
+    )
+{
+return (const char*)p >= heap.region && (const char*)p < heap.region_end;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval** gc_cells
+    (
+    lval* owner,
+    int count
+    )
+{
+/* Young lists keep their cells in the region, which is released with
+ * the nursery */
+if( gc_is_young(owner) )
+    {
+    lval** cells = gc_region_alloc(sizeof(lval*) << slab_class(count));
+    if( cells ) { return cells; }
+
+    /* Otherwise the list frees them if it dies young */
+    if( owner->data.cell == NULL || gc_in_region(owner->data.cell) )
+        {
+        gc_push(&heap.finalizable, owner);
+        }
+    }
+
+return slab_alloc(count);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_release_cells
+    (
+    lval** cells,
+    int count
+    )
+{
+if( !gc_in_region(cells) ) { slab_release(cells, count); }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_bind
+    (
+    symbol* s,
+    lval* v
+    )
+{
+/* Globals bound to young values are roots of the next minor
+ * collection, a major one marks from every global */
+s->value = v;
+if( s->bound || v == NULL || lval_is_int(v) || !gc_is_young(v) ) { return; }
+
+s->bound = 1;
+if( heap.bound_num == heap.bound_capacity )
+    {
+    heap.bound_capacity = heap.bound_capacity ? heap.bound_capacity * 2 : 64;
+    heap.bound = realloc(heap.bound, sizeof(symbol*) * heap.bound_capacity);
+    }
+heap.bound[heap.bound_num++] = s;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_barrier
+    (
+    lval* owner,
+    lval* v
+    )
+{
+/* Called after v is stored in owner */
+if( lval_is_int(v) || gc_is_young(owner) ) { return; }
+
+if( gc_is_young(v) )
+    {
+    gc_remember(owner);
+    }
+else if( heap.phase == GC_MARKING && owner->marked == heap.epoch )
+    {
+    /* A black value must not point to a white one */
+    gc_mark(v);
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_remember
+    (
+    lval* owner
+    )
+{
+/* Values in the nursery are always scanned */
+if( gc_is_young(owner) ) { return; }
+
+/* A changed value which was already marked is marked again */
+if( heap.phase == GC_MARKING && owner->marked == heap.epoch )
+    {
+    gc_push(&heap.gray, owner);
+    }
+
+if( !owner->remembered )
+    {
+    owner->remembered = 1;
+    gc_push(&heap.remembered, owner);
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_push
+    (
+    gc_stack* s,
+    lval* v
+    )
+{
+if( s->num == s->capacity )
+    {
+    s->capacity = s->capacity ? s->capacity * 2 : 256;
+    s->items = realloc(s->items, sizeof(lval*) * s->capacity);
+    }
+s->items[s->num++] = v;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_collect
+    (
+    void
+    )
+{
+clock_t start = clock();
+
+gc_minor();
+heap.pending = 0;
+
+/* A new epoch turns every old value white */
+if( heap.phase == GC_IDLE && heap.major )
+    {
+    heap.major = 0;
+    heap.epoch = heap.epoch == 1 ? 2 : 1;
+    heap.phase = GC_MARKING;
+    heap.debt = 0;
+    gc_mark_roots();
+    }
+
+if( heap.phase != GC_IDLE )
+    {
+    gc_step(start + heap.pause_target);
+    }
+
+gc_record(clock() - start);
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_step
+    (
+    clock_t deadline
+    )
+{
+if( heap.phase == GC_MARKING )
+    {
+    if( !gc_drain(deadline) ) { return; }
+
+    /* The roots change without a barrier, so they are marked again
+     * and what they reach is finished in this step */
+    gc_mark_roots();
+    gc_drain(0);
+    heap.phase = GC_SWEEPING;
+    heap.sweep_chunk = 0;
+    }
+
+if( gc_sweep(deadline) )
+    {
+    heap.phase = GC_IDLE;
+    heap.threshold = heap.live * 2 > GC_MIN_THRESHOLD ? heap.live * 2 : GC_MIN_THRESHOLD;
+    heap.majors++;
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_minor
+    (
+    void
+    )
+{
+/* Move the values reachable from the roots, then those reachable
+ * from the values moved */
+for( size_t i = 0; i < heap.bound_num; ++i )
+    {
+    heap.bound[i]->bound = 0;
+    gc_evacuate(&heap.bound[i]->value);
+    }
+heap.bound_num = 0;
+
+for( lval** x = machine.stack; x < machine.sp; ++x )
+    {
+    gc_evacuate(x);
+    }
+
+if( machine.top )
+    {
+    for( int i = 0; i < machine.top->constants_num; ++i )
+        {
+        gc_evacuate(&machine.top->constants[i]);
+        }
+    }
+
+for( int i = 0; i < heap.roots_num; ++i )
+    {
+    gc_evacuate(heap.roots[i]);
+    }
+
+/* After this no old value points into the nursery */
+for( size_t i = 0; i < heap.remembered.num; ++i )
+    {
+    heap.remembered.items[i]->remembered = 0;
+    gc_scan(heap.remembered.items[i]);
+    }
+heap.remembered.num = 0;
+
+while( heap.copied.num > 0 )
+    {
+    gc_scan(heap.copied.items[--heap.copied.num]);
+    }
+
+/* What was not moved is dead. Only the values owning memory outside
+ * the region need freeing, each once. */
+for( size_t i = 0; i < heap.finalizable.num; ++i )
+    {
+    lval* v = heap.finalizable.items[i];
+    if( v->type != LVAL_MOVED && v->type != LVAL_FREE )
+        {
+        gc_finalize(v);
+        v->type = LVAL_FREE;
+        }
+    }
+heap.finalizable.num = 0;
+heap.nursery_top = heap.nursery;
+heap.region_top = heap.region;
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_evacuate
+    (
+    lval** slot
+    )
+{
+lval* v = *slot;
+lval* x;
+
+if( v == NULL || lval_is_int(v) || !gc_is_young(v) ) { return; }
 
-lval* lval_read
-    (
-    mpc_ast_t* t
-    );
+/* Values reached twice are moved once */
+if( v->type == LVAL_MOVED )
+    {
+    *slot = v->data.next;
+    return;
+    }
 
-lval* lval_read_num
-    (
-    mpc_ast_t* t
-    );
+/* The copy takes over the cell array, error text or function, those
+ * in the region are copied out of it */
+x = gc_alloc_old();
+x->type = v->type;
+x->cell_count = v->cell_count;
+x->data = v->data;
+if( x->type == LVAL_SEXPR && gc_in_region(x->data.cell) )
+    {
+    x->data.cell = slab_alloc(x->cell_count);
+    memcpy(x->data.cell, v->data.cell, sizeof(lval*) * x->cell_count);
+    }
+if( x->type == LVAL_ERR && gc_in_region(x->data.err) )
+    {
+    x->data.err = malloc(strlen(v->data.err) + 1);
+    strcpy(x->data.err, v->data.err);
+    }
 
-lval* lval_add
-    (
-    lval* v,
-    lval* x
-    );
+v->type = LVAL_MOVED;
+v->data.next = x;
+*slot = x;
+gc_push(&heap.copied, x);
 
-/* Constructors */
-lval* lval_num
-    (
-    long num
-    );
+/* While marking it is gray, what it points to is still to be marked */
+if( heap.phase == GC_MARKING ) { gc_push(&heap.gray, x); }
+}
 
-lval* lval_err
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_scan
     (
-    char* msg
-    );
+    lval* v
+    )
+{
+lambda* fn;
 
-lval* lval_sym
-    (
-    char* sym
-    );
+switch( v->type )
+    {
+    case LVAL_SEXPR:
+        for( int i = 0; i < v->cell_count; ++i )
+            {
+            gc_evacuate(&v->data.cell[i]);
+            }
+        break;
 
-lval* lval_sexpr
+    case LVAL_LAMBDA:
+        fn = v->data.fn;
+        gc_evacuate(&fn->formals);
+        gc_evacuate(&fn->body);
+        if( fn->code )
+            {
+            for( int i = 0; i < fn->code->constants_num; ++i )
+                {
+                gc_evacuate(&fn->code->constants[i]);
+                }
+            }
+#ifdef CLISP_JIT
+        if( fn->native )
+            {
+            for( int i = 0; i < fn->native->callees_num; ++i )
+                {
+                gc_evacuate(&fn->native->callees[i]);
+                }
+            }
+#endif
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_mark_roots
     (
     void
-    );
+    )
+{
+/* The nursery is empty, so everything marked is old. The globals: */
+for( size_t i = 0; i < symbols.capacity; ++i )
+    {
+    if( symbols.slots[i] ) { gc_mark(symbols.slots[i]->value); }
+    }
 
-void lval_del
-    (
-    lval* v
-    );
+/* The VM stack, which holds every function being run, and the
+ * top-level code */
+for( lval** x = machine.stack; x < machine.sp; ++x )
+    {
+    gc_mark(*x);
+    }
 
-/* Utility */
-void lval_expr_print
-    (
-    lval* v,
-    char open,
-    char close
-    );
+if( machine.top ) { gc_mark_proto(machine.top); }
 
-void lval_print
-    (
-    lval* v
-    );
+/* Values held by the evaluator between safe points */
+for( int i = 0; i < heap.roots_num; ++i )
+    {
+    gc_mark(*heap.roots[i]);
+    }
+}
 
-void lval_println
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_mark
     (
     lval* v
-    );
+    )
+{
+/* Inline integers are not on the heap */
+if( v == NULL || lval_is_int(v) || v->marked == heap.epoch ) { return; }
+
+/* Children are marked from the gray stack, not by recursion, so deep
+ * lists can not overflow the C stack */
+v->marked = heap.epoch;
+gc_push(&heap.gray, v);
+}
 
 /*---------------------------------------------------------------------
- * FUNCTIONS
  *---------------------------------------------------------------------*/
-int main
+void gc_mark_proto
     (
-    int argc,
-    char** argv
+    const proto* p
     )
 {
-/* Create language parsers */
-mpc_parser_t* number      = mpc_new("number");
-mpc_parser_t* symbol      = mpc_new("symbol");
-mpc_parser_t* sexpression = mpc_new("sexpression");
-mpc_parser_t* expression  = mpc_new("expression");
-mpc_parser_t* program     = mpc_new("program");
-
-/* Define the language rules */
-mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                   \
-    number      : /-?[0-9]+/ ;                          \
-    symbol      : '+' | '-' | '*' | '/' | '%' ;         \
-    sexpression : '(' <expression>* ')' ;               \
-    expression  : <number> | <symbol> | <sexpression> ; \
-    program     : /^/ <expression>* /$/ ;               \
-    ",
-    number, symbol, sexpression, expression, program);
+for( int i = 0; i < p->constants_num; ++i )
+    {
+    gc_mark(p->constants[i]);
+    }
+}
 
-/* Print out system information */
-puts("C Lisp Version 0.0.0");
-puts("Press Ctrl+C to Exit\n");
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int gc_drain
+    (
+    clock_t deadline
+    )
+{
+/* Returns whether the gray stack is empty. A deadline of 0 drains
+ * all of it. */
+int n = 0;
 
-while(1)
+while( heap.gray.num > 0 )
     {
-    /* This REPL loop takes a user input and parses it */
-    char* input;
-    mpc_result_t r;
+    lval* v = heap.gray.items[--heap.gray.num];
+    lambda* fn;
 
-    /* Read the user input */
-    input = readline("C-Lisp> ");
+    switch( v->type )
+        {
+        case LVAL_SEXPR:
+            for( int i = 0; i < v->cell_count; ++i )
+                {
+                gc_mark(v->data.cell[i]);
+                }
+            break;
 
-    /* Allow the user to press up to retrieve command */
-    add_history(input);
+        /* A function keeps its source, the constants of its code and
+         * the functions its native code calls */
+        case LVAL_LAMBDA:
+            fn = v->data.fn;
+            gc_mark(fn->formals);
+            gc_mark(fn->body);
+            if( fn->code ) { gc_mark_proto(fn->code); }
+#ifdef CLISP_JIT
+            if( fn->native )
+                {
+                for( int i = 0; i < fn->native->callees_num; ++i )
+                    {
+                    gc_mark(fn->native->callees[i]);
+                    }
+                }
+#endif
+            break;
 
-    /* Parse the user input */
-    if( mpc_parse("<stdin>", input, program, &r) )
-        {
-        /* Success: Print the expression */
-        lval* x = lval_read(r.output);
-        lval_println(x);
-        lval_del(x);
-        mpc_ast_delete(r.output);
+        default:
+            break;
         }
-    else
+
+    heap.debt--;
+    if( deadline && ++n % GC_STEP_CHECK == 0 && heap.debt <= 0 && clock() >= deadline )
         {
-        /* Failure: Print the error */
-        mpc_err_print(r.error);
-        mpc_err_delete(r.error);
+        return heap.gray.num == 0;
         }
-
-    /* Free the pointer allocated by readline */
-    free(input);
     }
 
-/* Free the parsers */
-mpc_cleanup(5, number, symbol, sexpression, expression, program);
+return 1;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval evaluate
+int gc_sweep
     (
-    mpc_ast_t* t
+    clock_t deadline
     )
 {
-/*
-char* operator;
-lval val;
-
-// Base Case: The tree's node is a number
-if( strstr(t->tag, "number") )
+/* Returns whether every chunk is swept. At least one chunk is swept
+ * each step, and as many as it takes to pay the debt. */
+while( heap.sweep_chunk < heap.chunks_num )
     {
-    // Convert str->long, then check stdlib's errno for overflow
-    long num;
+    lval* chunk = heap.chunks[heap.sweep_chunk++];
+    for( int j = GC_CHUNK - 1; j >= 0; --j )
+        {
+        lval* v = &chunk[j];
+        if( v->type == LVAL_FREE || v->marked == heap.epoch ) { continue; }
 
-    errno = 0;
-    num = strtol(t->contents, NULL, 10);
-    return errno != ERANGE
-        ? lval_num(num)
-        : lval_err(LVAL_ERR_BAD_NUM);
+        gc_finalize(v);
+        heap.live--;
+        v->type = LVAL_FREE;
+        v->data.next = heap.free;
+        heap.free = v;
+        }
+
+    heap.debt -= GC_CHUNK;
+    if( heap.debt <= 0 && clock() >= deadline ) { break; }
     }
 
-// Recursion: Determine the operator, then use it on all children.
-//            1st child: '('
-//            2nd child: an operator
-//            Nth child: Numbers/expressions. These are ended by the non-expr ')'
-operator = t->children[1]->contents;
-val = evaluate(t->children[2]);
+return heap.sweep_chunk == heap.chunks_num;
+}
 
-for( int ii = 3; strstr(t->children[ii]->tag, "expr"); ++ii )
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+void gc_finalize
+    (
+    lval* v
+    )
+{
+/* Free what a value owns outside the heap and the region */
+switch( v->type )
     {
-    val = evaluate_op(val, evaluate(t->children[ii]), operator);
-    }
+    case LVAL_ERR:
+        if( !gc_in_region(v->data.err) ) { free(v->data.err); }
+        break;
 
-return val;
-*/
+    case LVAL_SEXPR: gc_release_cells(v->data.cell, v->cell_count);
+        break;
+
+    case LVAL_LAMBDA: lambda_free(v->data.fn);
+        break;
+
+    default:
+        break;
+    }
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval evaluate_op
+void gc_record
     (
-    lval x,
-    lval y,
-    char* operator
+    clock_t pause
     )
 {
-/*
-if( LVAL_ERR == x.type ) { return x; }
-if( LVAL_ERR == y.type ) { return y; }
+double us = (double)pause * 1000000 / CLOCKS_PER_SEC;
+int bucket = 0;
 
-// FIXME: Error check for overlow in the float values
-if( strcmp(operator, "+") == 0 ) { return lval_num(x.num + y.num); }
-if( strcmp(operator, "-") == 0 ) { return lval_num(x.num - y.num); }
-if( strcmp(operator, "*") == 0 ) { return lval_num(x.num * y.num); }
-if( strcmp(operator, "%") == 0 ) { return lval_num(x.num % y.num); }
-if( strcmp(operator, "/") == 0 )
+/* Bucket i holds the pauses shorter than 2^i microseconds */
+while( bucket < GC_PAUSE_BUCKETS - 1 && us >= (double)( 1ul << bucket ) )
     {
-    return y.num == 0
-        ? lval_err(LVAL_ERR_DIV_ZERO)
-        : lval_num(x.num / y.num);
+    ++bucket;
     }
 
-return lval_err(LVAL_ERR_BAD_OP);
-*/
+heap.pauses[bucket]++;
+heap.pause_total += pause;
+if( pause > heap.pause_max ) { heap.pause_max = pause; }
+heap.minors++;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_read
+void gc_print_stats
     (
-    mpc_ast_t* t
+    void
     )
 {
-/* If Symbol or Number return conversion to that type */
-if( strstr(t->tag, "number") ) { return lval_read_num(t); }
-if( strstr(t->tag, "symbol") ) { return lval_sym(t->contents); }
+static const char* phases[] = { "idle", "marking", "sweeping" };
+static const char* types[] = { "error", "number", "sexpr", "symbol", "builtin", "lambda" };
+double us = 1000000.0 / CLOCKS_PER_SEC;
+size_t counts[LVAL_LAMBDA + 1] = { 0 };
 
-/* If root (>) or sexpr then create empty list */
-lval* x = NULL;
-if( strcmp(t->tag, ">") == 0 ) { x = lval_sexpr(); }
-if( strstr(t->tag, "sexpr") )  { x = lval_sexpr(); }
+/* Values by type, counting those which are dead but not yet swept */
+for( lval* v = heap.nursery; v < heap.nursery_top; ++v )
+    {
+    if( v->type <= LVAL_LAMBDA ) { counts[v->type]++; }
+    }
+for( int i = 0; i < heap.chunks_num; ++i )
+    {
+    for( int j = 0; j < GC_CHUNK; ++j )
+        {
+        lval* v = &heap.chunks[i][j];
+        if( v->type <= LVAL_LAMBDA ) { counts[v->type]++; }
+        }
+    }
 
-/* Fill empty list with valid expressions from children */
-for( int i = 0; i < t->children_num; ++i )
+printf("gc: %lu live of %lu old cells, %lu allocated, %s\n",
+    (unsigned long)heap.live,
+    (unsigned long)heap.chunks_num * GC_CHUNK,
+    (unsigned long)heap.allocated,
+    phases[heap.phase]);
+for( int i = 0; i <= LVAL_LAMBDA; ++i )
     {
-    // TODO: Why do we ignore brackets?
-    if( strcmp(t->children[i]->contents, "(") == 0 ) { continue; }
-    if( strcmp(t->children[i]->contents, ")") == 0 ) { continue; }
-    if( strcmp(t->children[i]->tag,  "regex") == 0 ) { continue; }
-    x = lval_add(x, lval_read(t->children[i]));
+    printf("gc:   %-8s %10lu\n", types[i], (unsigned long)counts[i]);
     }
+printf("gc: %lu of %d region bytes used\n",
+    (unsigned long)( heap.region_top - heap.region ), GC_REGION);
+printf("gc: %lu collections, %lu major, pause target %.0fus\n",
+    (unsigned long)heap.minors,
+    (unsigned long)heap.majors,
+    heap.pause_target * us);
 
-return x;
+if( heap.minors == 0 ) { return; }
+
+printf("gc: pauses mean %.1fus, max %.0fus\n",
+    heap.pause_total * us / heap.minors,
+    heap.pause_max * us);
+for( int i = 0; i < GC_PAUSE_BUCKETS; ++i )
+    {
+    if( heap.pauses[i] == 0 ) { continue; }
+    printf("gc:   < %8luus %10lu\n", 1ul << i, (unsigned long)heap.pauses[i]);
+    }
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_read_num
+void gc_protect
     (
-    mpc_ast_t* t
+    lval** v
     )
 {
-/* Convert str->long, then check stdlib's errno for overflow */
-long num;
-
-errno = 0;
-num = strtol(t->contents, NULL, 10);
-return errno != ERANGE
-    ? lval_num(num)
-    : lval_err("Invalid number");
+/* The variable is protected, a collection may move its value */
+if( heap.roots_num == heap.roots_capacity )
+    {
+    heap.roots_capacity = heap.roots_capacity ? heap.roots_capacity * 2 : 16;
+    heap.roots = realloc(heap.roots, sizeof(lval**) * heap.roots_capacity);
+    }
+heap.roots[heap.roots_num++] = v;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_add
+void gc_unprotect
     (
-    lval* v,
-    lval* x
+    void
     )
 {
-v->cell_count++;
-v->cell = realloc(v->cell, sizeof(lval*) * v->cell_count);
-v->cell[v->cell_count - 1] = x;
-return v;
+/* Roots are released in the reverse order they were protected */
+heap.roots_num--;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_num
+void slab_free
     (
-    long num
+    void
     )
 {
-lval* lisp_value;
-
-lisp_value = malloc(sizeof(lval));
-lisp_value->type = LVAL_NUM;
-lisp_value->num = num;
+/* Every array has been released by the time the heap is freed */
+for( int i = 0; i < slabs.blocks_num; ++i )
+    {
+    free(slabs.blocks[i]);
+    }
 
-return lisp_value;
+free(slabs.blocks);
+memset(&slabs, 0, sizeof(slabs));
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_err
+int slab_class
     (
-    char* msg
+    int count
     )
 {
-lval* lisp_value;
-
-lisp_value = malloc(sizeof(lval));
-lisp_value->type = LVAL_ERR;
-lisp_value->err = malloc(strlen(msg) + 1);
-strcpy(lisp_value->err, msg);
-
-return lisp_value;
+/* The smallest power of two which holds count */
+int k = 0;
+while( ( 1 << k ) < count ) { ++k; }
+return k;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_sym
+lval** slab_alloc
     (
-    char* sym
+    int count
     )
 {
-lval* lisp_value;
+int k = slab_class(count);
+size_t size = sizeof(lval*) << k;
+lval** cells;
 
-lisp_value = malloc(sizeof(lval));
-lisp_value->type = LVAL_SYM;
-lisp_value->sym = malloc(strlen(sym) + 1);
-strcpy(lisp_value->sym, sym);
+if( k >= SLAB_CLASSES )
+    {
+    slabs.large++;
+    return malloc(size);
+    }
 
-return lisp_value;
+slabs.live[k]++;
+
+/* Free arrays are chained through their first element */
+if( slabs.free[k] )
+    {
+    cells = slabs.free[k];
+    slabs.free[k] = *(lval***)cells;
+    return cells;
+    }
+
+/* The rest of a block too small for the array is left unused */
+if( (size_t)( slabs.end - slabs.top ) < size )
+    {
+    slabs.top = malloc(SLAB_BLOCK);
+    slabs.end = slabs.top + SLAB_BLOCK;
+    slabs.blocks = realloc(slabs.blocks, sizeof(char*) * ( slabs.blocks_num + 1 ));
+    slabs.blocks[slabs.blocks_num++] = slabs.top;
+    }
+
+cells = (lval**)slabs.top;
+slabs.top += size;
+return cells;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-lval* lval_sexpr
+void slab_release
     (
-    void
+    lval** cells,
+    int count
     )
 {
-lval* lisp_value;
+int k;
 
-lisp_value = malloc(sizeof(lval));
-lisp_value->type = LVAL_SEXPR;
-lisp_value->cell = NULL;
-lisp_value->cell_count = 0;
+/* Empty lists have no array */
+if( cells == NULL ) { return; }
 
-return lisp_value;
+k = slab_class(count);
+if( k >= SLAB_CLASSES )
+    {
+    slabs.large--;
+    free(cells);
+    return;
+    }
+
+slabs.live[k]--;
+*(lval***)cells = slabs.free[k];
+slabs.free[k] = cells;
 }
 
 /*---------------------------------------------------------------------
  *---------------------------------------------------------------------*/
-void lval_del
+void slab_print_stats
     (
-    lval* v
+    void
     )
 {
-switch( v->type )
+printf("slab: %d blocks of %d bytes\n", slabs.blocks_num, SLAB_BLOCK);
+for( int i = 0; i < SLAB_CLASSES; ++i )
     {
-    /* Do nothing special for Num */
-    case LVAL_NUM:
-        break;
+    if( slabs.live[i] == 0 ) { continue; }
+    printf("slab:   %5d cells %10lu live\n", 1 << i, (unsigned long)slabs.live[i]);
+    }
+if( slabs.large > 0 )
+    {
+    printf("slab:   larger     %10lu live\n", (unsigned long)slabs.large);
+    }
+}
 
-    /* Free string data for Err and Sym */
-    case LVAL_ERR: free(v->err);
-        break;
-    case LVAL_SYM: free(v->sym);
-        break;
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+int lval_is_int
+    (
+    const lval* v
+    )
+{
+/* Allocated values are aligned, so their low bit is always clear */
+return ( (uintptr_t)v & 1 ) != 0;
+}
 
-    /* Free all elements in Sexpr */
-    case LVAL_SEXPR:
-        for( int i = 0; i < v->cell_count; ++i )
-            {
-            lval_del(v->cell[i]);
-            }
-        /* Free the array of pointers */
-        free(v->cell);
-        break;
-    }
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+lval_type_field lval_type
+    (
+    const lval* v
+    )
+{
+return lval_is_int(v) ? LVAL_NUM : v->type;
+}
 
-free(v);
+/*---------------------------------------------------------------------
+ *---------------------------------------------------------------------*/
+long lval_to_num
+    (
+    const lval* v
+    )
+{
+/* Shifting the signed word back keeps the sign of the integer */
+return lval_is_int(v)
+    ? (long)( (intptr_t)v >> 1 )
+    : v->data.num;
 }
 
 /*---------------------------------------------------------------------
@@ -413,7 +5058,7 @@ putchar(open);
 for( int i = 0; i < v->cell_count; ++i )
     {
     /* Print children with spaces inbetween */
-    lval_print(v->cell[i]);
+    lval_print(v->data.cell[i]);
     if( i != ( v->cell_count - 1 ) )
         putchar(' ');
     }
@@ -427,11 +5072,19 @@ void lval_print
     lval* v
     )
 {
-switch( v->type )
+switch( lval_type(v) )
     {
-    case LVAL_NUM:      printf("%li", v->num); break;
-    case LVAL_ERR:      printf("Error: %s", v->err); break;
-    case LVAL_SYM:      printf("%s", v->sym); break;
+    case LVAL_NUM:      printf("%li", lval_to_num(v)); break;
+    case LVAL_ERR:      printf("Error: %s", v->data.err); break;
+    case LVAL_SYM:      printf("%s", v->data.sym->name); break;
+    case LVAL_FUN:      printf("%s", v->data.fun->name); break;
+    case LVAL_LAMBDA:
+        printf("(fn ");
+        lval_print(v->data.fn->formals);
+        putchar(' ');
+        lval_print(v->data.fn->body);
+        putchar(')');
+        break;
     case LVAL_SEXPR:    lval_expr_print(v, '(', ')'); break;
     default:            break;
     }
@@ -0,0 +1,10 @@
+(def r (fn (n) (if (== n 0) 0 (+ 1 (r (- n 1))))))
+(r 10000)
+(r 10001)
+(r 1000000)
+(def inf (fn (n) (inf n)))
+(inf 1)
+(def loop (fn (n acc) (if (== n 0) acc (loop (- n 1) (+ acc 1)))))
+(loop 9999 0)
+(loop 100000 0)
+(r 5)
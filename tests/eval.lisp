@@ -0,0 +1,97 @@
+(+ 1 2)
+(def fib (fn (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 20)
+fib
+(def sq (fn (x) (* x x)))
+(sq 3037000499)
+(sq 3037000500)
+(sq 4611686018427387904)
+(def f (fn (a b c) (- a b c)))
+(f 10 3 2)
+(f 1 2)
+(if 0 1 2)
+(if 5 1 2)
+(if (fn () 1) 1 2)
+(if)
+(def 3 4)
+(fn (1) 2)
+(fn x 2)
+(1 2)
+()
+(undefined 1 2)
+(+ 1 (/ 4 0))
+(% -7 2)
+(/ -7 2)
+(% 7 -1)
+(/ 4611686018427387903 -1)
+(< 1 2)
+(>= 2 2)
+(== 3 4)
+(!= 3 4)
+(< 1 2 3)
+(def + -)
+(+ 10 3)
+(def + 5)
+(+ 1 2)
+(def id (fn (x) x))
+(id (fn (y) (* y 2)))
+((id (fn (y) (* y 2))) 21)
+(def g (fn (x) (h x)))
+(g 1)
+(def h (fn (y) (* y 3)))
+(g 4)
+(def k (fn (x) ((fn (y) (+ y 1)) x)))
+(k 5)
+(def outer (fn (x) ((fn (y) x) 1)))
+(outer 7)
+(def x 100)
+(outer 7)
+(def loop (fn (n acc) (if (== n 0) acc (loop (- n 1) (* acc 1)))))
+(loop 1000 1)
+(- 5)
+(- 3 4 5 6)
+(* 2 3 4)
+(def big 9223372036854775807)
+(- big 1)
+(+ big 1)
+99999999999999999999
+(+ 99999999999999999999 1)
+(if 1 99999999999999999999 2)
+(def inf (fn (n) (inf n)))
+(% -9223372036854775808 -1)
+(1 2)
+()
+(- 5)
+(* 3037000500 3037000500)
+(* -3 -4 -5)
+(+ 1 (/ 2 0) 3)
+(% 7 3)
+(* -4611686018427387904 2)
+(* 4611686018427387904 -2)
+(* -4611686018427387905 2)
+(+ 4611686018427387903 1)
+(- 4611686018427387904 1)
+(- -4611686018427387904 1)
+(+ -4611686018427387905 1)
+(* 9223372036854775807 1)
+(+ 1 x)
+(x)
++
+(+ 1 2)
+(def x 10)
+(* x x)
+(def y (+ x 1))
+y
+(def add +)
+(add x y)
+(def 3 4)
+(def z)
+foo
+(foo 1)
+(- -5)
+-x
+(def x (/ 1 0))
+x
+(def x 4611686018427387904)
+(+ x x)
+x
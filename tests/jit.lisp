@@ -0,0 +1,73 @@
+(def fib (fn (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 25)
+(def p (fn (n) (if (== n 0) 1 (* 3 (p (- n 1))))))
+(p 10)
+(p 39)
+(p 40)
+(p 45)
+(def d (fn (a b) (+ (/ a b) (% a b))))
+(def dl (fn (n) (if (== n 0) 0 (+ (d n 3) (dl (- n 1))))))
+(dl 1200)
+(d 7 0)
+(d -9223372036854775807 -1)
+(d 10 -1)
+(def k 5)
+(def addk (fn (x) (+ x k)))
+(def sk (fn (n) (if (<= n 0) 0 (+ (addk n) (sk (- n 1))))))
+(sk 2000)
+(def k 10)
+(sk 2000)
+(def k 4611686018427387904)
+(sk 10)
+(def k 1)
+(sk 2000)
+(def ev (fn (n) (if (== n 0) 1 (od (- n 1)))))
+(def od (fn (n) (if (== n 0) 0 (ev (- n 1)))))
+(ev 3000)
+(ev 3001)
+(od 3001)
+(def cmp (fn (a b) (+ (< a b) (+ (> a b) (+ (<= a b) (+ (>= a b) (+ (== a b) (!= a b))))))))
+(def cl (fn (n) (if (== n 0) 0 (+ (cmp n 1000) (cl (- n 1))))))
+(cl 2000)
+(fib 20)
+(def - +)
+(fib 10)
+(def - (fn (a b) (+ a (* -1 b))))
+(fib 15)
+(def big (fn (x) (* x 2)))
+(def bl (fn (n) (if (== n 0) 0 (+ (big 4611686018427387903) (bl (- n 1))))))
+(bl 1)
+(def sum (fn (n) (if (== n 0) 0 (+ n (sum (- n 1))))))
+(sum 1500)
+(sum 100000)
+(sum (fn () 1))
+(def inc (fn (x) (+ x 1)))
+(def inc2 (fn (x) (+ x 2)))
+(def pick (fn (c x) ((if c inc inc2) x)))
+(def pl (fn (n) (if (== n 0) 0 (+ (pick (% n 2) n) (pl (- n 1))))))
+(pl 2000)
+(pick 1 10)
+(pick 0 10)
+(def fst (fn (a b) a))
+(def pass (fn (x) (fst inc x)))
+(def passl (fn (n) (if (== n 0) 0 (+ (fst n (pass n)) (passl (- n 1))))))
+(passl 2000)
+(pass 5)
+((pass 5) 5)
+(def choose (fn (c) (if c inc inc2)))
+(def cl2 (fn (n) (if (== n 0) 0 (+ ((choose (% n 2)) n) (cl2 (- n 1))))))
+(cl2 2000)
+(choose 1)
+(choose 0)
+(def givef (fn (c) (if c 1 inc)))
+(def gl (fn (n) (if (== n 0) 0 (+ (givef 1) (gl (- n 1))))))
+(gl 2000)
+(givef 0)
+(def ret (fn (x) inc))
+(def rl (fn (n) (if (== n 0) 0 (+ ((ret n) n) (rl (- n 1))))))
+(rl 2000)
+(ret 1)
+(def app (fn (f x) (f x)))
+(def al (fn (n) (if (== n 0) 0 (+ (app inc n) (al (- n 1))))))
+(al 2000)
+(app inc2 5)
@@ -0,0 +1,15 @@
+(def λ 5)
+(+ λ 1)
+(def 名前 7)
+名前
+(+ 1 2)
+(+ 1 )
+(+ 3 4)
+(+ 1 )
+(+ 5 6)
+(+ 1 2)
+(* 3 #)
+- 5
+(+ 1 (2)
+)) 9 a (8)
+(+ 1
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Runs every test program with each evaluator and compares its output
+# with the expected output, which is the tree walker's. The VM, native
+# code and native code checked against the tree walker must all agree.
+
+LISP=${LISP:-./c-lisp}
+out=$(mktemp)
+status=0
+
+for program in tests/*.lisp; do
+    expected=${program%.lisp}.expected
+    for mode in --tree --no-jit "" --jit-verify; do
+        $LISP $mode "$program" > "$out" 2>&1
+        if diff -u "$expected" "$out" > /dev/null; then
+            echo "ok   $program ${mode:-(default)}"
+        else
+            echo "FAIL $program ${mode:-(default)}"
+            diff -u "$expected" "$out"
+            status=1
+        fi
+    done
+done
+
+rm -f "$out"
+exit $status